@@ -1,72 +1,201 @@
 #pragma once
-#include "tensor.h"
-#include <fstream>
 
-namespace MNIST {
+#include "./mapped_file.h"
+#include "./gates_unit/GateObject.h"
+#include "./gates_unit/GateTrainer.h"
+#include <atomic>
+#include <stdio.h>
+#include <string>
 
-struct uint32_HE_t {
-   uint32_t value;
-   operator uint32_t() {
-      return _byteswap_ulong(value);
-   }
-};
+namespace ins {
+   namespace MNIST {
 
-   struct UByteTensorFile {
+      // Big-endian 32 bits integer, as stored by IDX headers
+      inline uint32_t read_u32_be(const uint8_t* bytes) {
+         return (uint32_t(bytes[0]) << 24) | (uint32_t(bytes[1]) << 16) | (uint32_t(bytes[2]) << 8) | uint32_t(bytes[3]);
+      }
 
-      struct tHeader {
-         uint8_t magic[3];
-         uint8_t dim;
-         uint32_HE_t count; // count defined by dim
-         uint32_HE_t sizes[4]; // count defined by dim
-      };
+      // Non-owning view of a sample bytes, valid while its file is open
+      typedef Span<const uint8_t> ByteView;
+
+      // IDX file of unsigned bytes (type 0x08), mapped in memory
+      // Header is: 0x00 0x00 0x08 dim, then 'dim' big-endian sizes, the first one being the samples count.
+      // eg. train-images.idx3-ubyte holds 60000 samples of 28x28, train-labels.idx1-ubyte 60000 bytes.
+      struct UByteTensorFile {
+         static constexpr uint8_t UByteType = 0x08;
+
+         MappedFile file;
+         uint8_t dim = 0;           // dimensions of a sample
+         uint32_t sizes[4] = {};    // sizes of a sample dimensions
+         uint32_t datacount = 0;    // samples count
+         uint32_t datasize = 0;     // bytes of a sample
+         const uint8_t* datas = 0;  // first sample bytes
+
+         UByteTensorFile() {
+         }
+         explicit UByteTensorFile(const std::string& path) {
+            this->open(path);
+         }
+
+         bool is_open() const {
+            return this->datas != 0;
+         }
+
+         // Map 'path', returns false when it cannot be opened or is not a valid ubyte IDX file
+         bool open(const std::string& path) {
+            this->close();
+            if (!file.open(path.c_str())) return false;
 
-      uint8_t dim = 0;
-      uint32_t sizes[4] = {};
-      uint32_t datacount = 0;
-      uint32_t datasize = 0;
-      uint8_t* datas = 0;
-
-      UByteTensorFile(std::string path) {
-         std::ifstream f(path, std::ios_base::in | std::ios_base::binary);
-         checkAssert(f.is_open());
-
-         tHeader header;
-         f.read((char*)&header, sizeof(tHeader));
-         checkAssert(header.dim <= 4);
-         this->dim = header.dim - 1;
-         this->datacount = header.count;
-         this->datasize = 1;
-         for (int i = 0; i < this->dim; i++) {
-            this->sizes[i] = header.sizes[i];
-            this->datasize *= this->sizes[i];
+            const uint8_t* header = file.data;
+            if (file.size < 4 || header[0] != 0 || header[1] != 0 || header[2] != UByteType) return this->close();
+            uint8_t header_dim = header[3];
+            if (header_dim < 1 || header_dim > 5) return this->close();
+            size_t header_size = 4 + 4 * size_t(header_dim);
+            if (file.size < header_size) return this->close();
+
+            // Sizes are bounded by the file before each product, so that a crafted header cannot wrap them
+            uint64_t file_datasize = file.size - header_size;
+            this->dim = header_dim - 1;
+            this->datacount = read_u32_be(header + 4);
+            uint64_t datasize = 1;
+            for (int i = 0; i < this->dim; i++) {
+               this->sizes[i] = read_u32_be(header + 8 + 4 * i);
+               if (this->sizes[i] && datasize > file_datasize / this->sizes[i]) return this->close();
+               datasize *= this->sizes[i];
+            }
+            if (datasize > UINT32_MAX || (datasize && this->datacount > file_datasize / datasize)) return this->close();
+            this->datasize = uint32_t(datasize);
+            this->datas = header + header_size;
+            return true;
+         }
+         bool close() {
+            file.close();
+            this->dim = 0;
+            this->datacount = 0;
+            this->datasize = 0;
+            this->datas = 0;
+            return false;
          }
 
-         int bufsz = this->datacount * this->datasize;
-         f.seekg(sizeof(uint32_t) * (2 + this->dim), std::ios_base::beg);
-         this->datas = (uint8_t*)malloc(bufsz);
-         f.read((char*)this->datas, bufsz);
+         size_t size() const {
+            return this->datacount;
+         }
+         ByteView get(size_t index) const {
+            return ByteView{ &this->datas[index * this->datasize], this->datasize };
+         }
+         // Label of sample 'index', for a file of scalar samples
+         uint8_t get_label(size_t index) const {
+            return this->datas[index * this->datasize];
+         }
+      };
+
+      // Default binarization threshold of pixels intensity
+      static constexpr uint8_t PixelThreshold = 127;
+
+      // Binarize a sample into bit-packed words, (sample.size + 63) / 64 words are written
+      inline void binarize(ByteView sample, uint64_t* words, uint8_t threshold = PixelThreshold) {
+         Kernels::threshold_bits(sample.data, sample.size, threshold, words);
       }
-      Tensor1D* getOrdinalTensor1D(int index, int range) {
-         if (dim != 0) return 0;
-         if (index >= this->datacount) return 0;
-         uint8_t ordinal = this->datas[index * this->datasize];
-         auto data = new Tensor1D(range);
-         data->values[ordinal] = 1.0;
-         return data;
+
+      // Binarize a sample straight into the states of an input layer of sample.size gates
+      inline void write_binarized(GateLayer* layer, GateContext& context, ByteView sample, uint8_t threshold = PixelThreshold) {
+         if (sample.size != layer->size()) throw std::invalid_argument("MNIST::write_binarized: one byte per input gate expected");
+
+         auto& state = context.get(layer);
+         size_t i = 0;
+         for (size_t w = 0; w < state.states.size(); w++, i += 64) {
+            uint64_t word = 0;
+            Kernels::threshold_bits(sample.data + i, std::min<size_t>(64, sample.size - i), threshold, &word);
+            state.changes[w] |= state.states[w] ^ word;
+            state.states[w] = word;
+         }
       }
-      Tensor1D* getTensor1D(int index) {
-         if (dim != 1) return 0;
-         if (index >= this->datacount) return 0;
-         auto data = new Tensor1D(sizes[0]);
-         data->fill(&this->datas[index * this->datasize], this->datasize);
-         return data;
+
+      // Images and labels of a MNIST set, eg. prefix "train" or "t10k"
+      struct Dataset {
+         UByteTensorFile images;
+         UByteTensorFile labels;
+
+         bool open(const std::string& dir, const std::string& prefix) {
+            images.open(dir + "/" + prefix + "-images.idx3-ubyte");
+            labels.open(dir + "/" + prefix + "-labels.idx1-ubyte");
+            return images.is_open() && labels.is_open() && labels.dim == 0 && images.size() == labels.size();
+         }
+         size_t size() const {
+            return images.size();
+         }
+      };
+
+      // Digits classifier: one input gate per binarized pixel, and one output gate per class
+      // Each output is trained as a one-vs-rest detector, the estimated class is the output of highest weights sum.
+      struct GateClassifier {
+         static constexpr uint32_t PixelsCount = 28 * 28;
+         static constexpr uint32_t ClassesCount = 10;
+         static constexpr Shapes::DenseShape DefaultShape = Shapes::DenseShape(3, PixelsCount, ClassesCount, 256, 1);
+
+         GateObjectModel model;
+         GateLayer& inputs;
+         GateLayer& outputs;
+         uint8_t threshold = PixelThreshold;
+
+         GateClassifier(const Shapes::DenseShape& shape = DefaultShape, uint64_t seed = GateRandom::DefaultSeed)
+            : model(shape, seed), inputs(*model.layers.front()), outputs(*model.layers.back()) {
+            if (inputs.size() != PixelsCount || outputs.size() != ClassesCount) throw std::invalid_argument("MNIST::GateClassifier: shape shall have one input per pixel and one output per class");
+         }
+
+         // Class of the last forward
+         uint8_t get_class(GateContext& context) const {
+            auto& accumulators = context.get(&outputs).accumulators;
+            return uint8_t(std::max_element(accumulators.begin(), accumulators.end()) - accumulators.begin());
+         }
+         uint8_t estimate(GateContext& context, ByteView image) {
+            write_binarized(&inputs, context, image, threshold);
+            model.compute_forward(context);
+            return this->get_class(context);
+         }
+         // Train on one sample, and return the class estimated before training
+         uint8_t train(GateContext& context, ByteView image, uint8_t label) {
+            uint8_t estimated = this->estimate(context, image);
+
+            // Reward each output matching its one-vs-rest target, punish the others
+            auto& feedback_signals = context.get(&outputs).feedback_signals;
+            for (uint32_t k = 0; k < ClassesCount; k++) {
+               bool expected = k == label;
+               feedback_signals[k] += (outputs.get_state(context, k) == expected) ? 1.0f : -1.0f;
+            }
+            model.compute_backward(context);
+
+            return estimated;
+         }
+      };
+
+      typedef GateHogwildTrainer<GateClassifier> GateClassifierTrainer;
+
+      // Train 'samples_count' samples drawn at random from 'dataset', over the trainer threads
+      inline GateClassifierTrainer::Report train(GateClassifierTrainer& trainer, const Dataset& dataset, size_t samples_count) {
+         return trainer.run(samples_count, [&](GateContext& context, GateRandom& random, size_t) {
+            size_t index = random.next() % dataset.size();
+            trainer.model.train(context, dataset.images.get(index), dataset.labels.get_label(index));
+            });
       }
-      Tensor2D* getTensor2D(int index) {
-         if (dim != 2) return 0;
-         if (index >= this->datacount) return 0;
-         auto data = new Tensor2D(sizes[0], sizes[1]);
-         data->fill(&this->datas[index * this->datasize], this->datasize);
-         return data;
+
+      // Estimate every sample of 'dataset' over the trainer threads, and count the correct ones
+      inline GateClassifierTrainer::Report evaluate(GateClassifierTrainer& trainer, const Dataset& dataset, size_t& correct_count) {
+         std::atomic<size_t> correct(0);
+         auto report = trainer.run(dataset.size(), [&](GateContext& context, GateRandom&, size_t index) {
+            if (trainer.model.estimate(context, dataset.images.get(index)) == dataset.labels.get_label(index)) {
+               correct.fetch_add(1, std::memory_order_relaxed);
+            }
+            });
+         correct_count = correct;
+         return report;
       }
-   };
+
+      // Seconds between background checkpoints while training
+      static constexpr double CheckpointPeriod = 30;
+
+      // Train and evaluate a classifier on the MNIST files of 'dir', reporting accuracy and throughput per epoch to 'log'
+      // With a checkpoint path, training resumes from it when it exists, and saves to it periodically and after each epoch.
+      int run(const char* dir, size_t epochs_count = 10, size_t threads_count = std::thread::hardware_concurrency(), const char* checkpoint_path = 0, FILE* log = stdout);
+   }
 }
@@ -0,0 +1,1348 @@
+#include "../gates_unit/GateObject.h"
+#include "../gates_unit/GateStatic.h"
+#include "../gates_unit/GateCheckpoint.h"
+#include "../gates_unit/GateLookup.h"
+#include "../gates_unit/GatePopulation.h"
+#include "../gates_unit/GateTrainer.h"
+#include "../MNIST.h"
+#include "codegen_sample.h"
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <memory>
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <tuple>
+
+using namespace ins;
+
+// Heap allocations count of the process, to check that steady-state steps do not allocate
+static std::atomic<uint64_t> allocations_count(0);
+
+void* operator new(size_t size) {
+   allocations_count.fetch_add(1, std::memory_order_relaxed);
+   if (void* p = malloc(size ? size : 1)) return p;
+   throw std::bad_alloc();
+}
+void* operator new[](size_t size) {
+   return operator new(size);
+}
+void operator delete(void* p) noexcept {
+   free(p);
+}
+void operator delete[](void* p) noexcept {
+   operator delete(p);
+}
+void operator delete(void* p, size_t) noexcept {
+   operator delete(p);
+}
+void operator delete[](void* p, size_t) noexcept {
+   operator delete(p);
+}
+
+// Over-aligned allocations, eg. arena blocks past the default alignment
+void* operator new(size_t size, std::align_val_t alignment) {
+   allocations_count.fetch_add(1, std::memory_order_relaxed);
+   size_t align = size_t(alignment);
+#if defined(_MSC_VER)
+   if (void* p = _aligned_malloc(size ? size : 1, align)) return p;
+#else
+   // aligned_alloc takes a size multiple of the alignment
+   if (void* p = aligned_alloc(align, (std::max<size_t>(size, 1) + align - 1) / align * align)) return p;
+#endif
+   throw std::bad_alloc();
+}
+void* operator new[](size_t size, std::align_val_t alignment) {
+   return operator new(size, alignment);
+}
+void operator delete(void* p, std::align_val_t) noexcept {
+#if defined(_MSC_VER)
+   _aligned_free(p);
+#else
+   free(p);
+#endif
+}
+void operator delete[](void* p, std::align_val_t alignment) noexcept {
+   operator delete(p, alignment);
+}
+void operator delete(void* p, size_t, std::align_val_t alignment) noexcept {
+   operator delete(p, alignment);
+}
+void operator delete[](void* p, size_t, std::align_val_t alignment) noexcept {
+   operator delete(p, alignment);
+}
+
+// Headless benchmark of the gates unit
+// Each case reports the mean ns per operation, as CSV (default) or JSON records:
+//    bitmesh-bench [--json] [--filter <substring>] [--min-time <seconds>] [--workers <count>] [--mnist <dir>]
+
+namespace {
+
+   struct BenchResult {
+      std::string name;
+      size_t width;
+      size_t depth;
+      size_t fan_in;
+      uint64_t iterations;
+      double ns_per_op;
+   };
+
+   struct Bench {
+      bool json = false;
+      const char* filter = 0;
+      double min_seconds = 0.1;
+      size_t workers_count = 1;
+      const char* mnist_dir = 0;
+      std::vector<BenchResult> results;
+      volatile uint64_t sink = 0; // keeps measured results alive
+
+      // Run op() with doubling iterations counts, until one run lasts min_seconds
+      template <class Fn>
+      void measure(const std::string& name, size_t width, size_t depth, size_t fan_in, Fn op) {
+         if (filter && !strstr(name.c_str(), filter)) return;
+
+         typedef std::chrono::steady_clock clock;
+         uint64_t iterations = 1;
+         for (;;) {
+            auto start = clock::now();
+            for (uint64_t k = 0; k < iterations; k++) op();
+            double seconds = std::chrono::duration<double>(clock::now() - start).count();
+            if (seconds >= min_seconds) {
+               this->record(name, width, depth, fan_in, iterations, seconds);
+               return;
+            }
+            uint64_t next = seconds > 0 ? uint64_t(double(iterations) * min_seconds * 1.2 / seconds) : iterations * 16;
+            iterations = std::min(std::max(next, iterations * 2), iterations * 16);
+         }
+      }
+
+      // Record 'iterations' operations which lasted 'seconds', eg. timed by the code under test
+      void record(const std::string& name, size_t width, size_t depth, size_t fan_in, uint64_t iterations, double seconds) {
+         if (filter && !strstr(name.c_str(), filter)) return;
+         results.push_back({ name, width, depth, fan_in, iterations, seconds * 1e9 / double(iterations) });
+         fprintf(stderr, "%-32s width=%-5zu depth=%-2zu fan_in=%-5zu %12.1f ns/op\n", name.c_str(), width, depth, fan_in, results.back().ns_per_op);
+      }
+
+      void print() const {
+         if (json) {
+            printf("{\n  \"isa\": \"%s\",\n  \"workers\": %zu,\n  \"results\": [\n", Kernels::isa_name(Kernels::dispatch().isa), workers_count);
+            for (size_t i = 0; i < results.size(); i++) {
+               auto& r = results[i];
+               printf("    {\"name\": \"%s\", \"width\": %zu, \"depth\": %zu, \"fan_in\": %zu, \"iterations\": %llu, \"ns_per_op\": %.3f}%s\n",
+                  r.name.c_str(), r.width, r.depth, r.fan_in, (unsigned long long)r.iterations, r.ns_per_op, i + 1 < results.size() ? "," : "");
+            }
+            printf("  ]\n}\n");
+         }
+         else {
+            printf("name,width,depth,fan_in,iterations,ns_per_op\n");
+            for (auto& r : results) {
+               printf("%s,%zu,%zu,%zu,%llu,%.3f\n", r.name.c_str(), r.width, r.depth, r.fan_in, (unsigned long long)r.iterations, r.ns_per_op);
+            }
+         }
+      }
+   };
+
+   // The kernels of each supported ISA shall give the sums of the scalar ones, over random weights and bits,
+   // for tail counts 1..63 and a few multiple blocks. 'get' returns the sum, abs sum and both sums kernels
+   // of a dispatch table, for weights of magnitude up to 'magnitude'.
+   template <class weight_t, class Get>
+   void check_kernels(const char* name, int64_t magnitude, Get get) {
+      Kernels::Dispatch scalar;
+      scalar.use(Kernels::Isa::Scalar);
+      GateRandom random(7);
+      for (auto isa : { Kernels::Isa::AVX2, Kernels::Isa::AVX512 }) {
+         Kernels::Dispatch dispatch;
+         if (!dispatch.use(isa)) continue;
+         for (size_t count = 1; count <= 300; count += count < 130 ? 1 : 85) {
+            std::vector<weight_t> weights(count);
+            std::vector<uint64_t> bits((count + 63) / 64);
+            for (auto& weight : weights) weight = weight_t(int64_t(random.next() % uint64_t(2 * magnitude + 1)) - magnitude);
+            for (auto& word : bits) word = random.next();
+            auto expected = get(scalar);
+            auto actual = get(dispatch);
+            int64_t expected_abs, actual_abs;
+            bool equal = std::get<0>(expected)(weights.data(), bits.data(), count) == std::get<0>(actual)(weights.data(), bits.data(), count)
+               && std::get<1>(expected)(weights.data(), bits.data(), count) == std::get<1>(actual)(weights.data(), bits.data(), count)
+               && std::get<2>(expected)(weights.data(), bits.data(), count, &expected_abs) == std::get<2>(actual)(weights.data(), bits.data(), count, &actual_abs)
+               && expected_abs == actual_abs;
+            if (!equal) {
+               fprintf(stderr, "%s kernels differ from scalar ones: isa=%s count=%zu\n", name, Kernels::isa_name(isa), count);
+               exit(1);
+            }
+         }
+      }
+   }
+   void check_kernels() {
+      check_kernels<int32_t>("i32", int64_t(1) << 24, [](const Kernels::Dispatch& d) { return std::make_tuple(d.masked_sum_i32, d.masked_abs_sum_i32, d.masked_sums_i32); });
+      check_kernels<int16_t>("i16", 32767, [](const Kernels::Dispatch& d) { return std::make_tuple(d.masked_sum_i16, d.masked_abs_sum_i16, d.masked_sums_i16); });
+      check_kernels<int8_t>("i8", 127, [](const Kernels::Dispatch& d) { return std::make_tuple(d.masked_sum_i8, d.masked_abs_sum_i8, d.masked_sums_i8); });
+   }
+
+   // Shape of 'fan_in' input gates, then 'depth' layers of 'width' gates
+   Shapes::DenseShape get_dense_shape(size_t fan_in, size_t width, size_t depth) {
+      if (depth < 2) return Shapes::DenseShape(uint32_t(depth + 1), uint32_t(fan_in), uint32_t(width));
+      return Shapes::DenseShape(uint32_t(depth + 1), uint32_t(fan_in), uint32_t(width), uint32_t(width), 1);
+   }
+
+   // Dense network, each layer linked to the previous one
+   struct DenseNetwork {
+      GateObjectModel model;
+      GateLayer* input;
+      GateRandom random;
+
+      DenseNetwork(size_t fan_in, size_t width, size_t depth, GateWorkerPool* workers)
+         : model(get_dense_shape(fan_in, width, depth)), random(1) {
+         input = model.layers[0];
+         model.set_workers(workers);
+         randomize_inputs();
+         model.compute_forward();
+      }
+      GateLayer* output() {
+         return model.layers.back();
+      }
+      void randomize_inputs() {
+         for (auto& word : model.context.get(input).states) word = random.next();
+      }
+      // Flip one input gate, as consecutive samples of a sweep do
+      void flip_input() {
+         auto& state = model.context.get(input);
+         size_t k = random.next() % input->size();
+         state.states[k >> 6] ^= uint64_t(1) << (k & 63);
+         state.changes[k >> 6] ^= uint64_t(1) << (k & 63);
+      }
+      void randomize_feedback(GateLayer* layer) {
+         auto& signals = model.context.get(layer).feedback_signals;
+         for (size_t i = 0; i < signals.size(); i++) {
+            signals[i] = (random.next() >> 63) ? 1.0f : -1.0f;
+         }
+      }
+   };
+
+   void bench_layers(Bench& bench, GateWorkerPool* workers) {
+      for (size_t width : { 64, 256, 1024 }) {
+         for (size_t fan_in : { 16, 256, 1024 }) {
+            DenseNetwork net(fan_in, width, 1, workers);
+            auto layer = net.output();
+            bench.measure("layer.compute_forward", width, 1, fan_in, [&]() {
+               layer->compute_forward(net.model.context, workers);
+               bench.sink = bench.sink + net.model.context.get(layer).states[0];
+               });
+            bench.measure("layer.compute_backward", width, 1, fan_in, [&]() {
+               net.randomize_feedback(layer);
+               layer->compute_backward(net.model.context, workers);
+               });
+         }
+      }
+   }
+
+   void bench_mutation(Bench& bench) {
+      struct Case { const char* name; Scalar prob; };
+      for (auto c : { Case{ "gate.mutate_weight.p0", 0.0f }, Case{ "gate.mutate_weight.p1_256", 1.0f / 256 }, Case{ "gate.mutate_weight.p1_2", 0.5f } }) {
+         GateRandom random(1);
+         std::vector<GateObject::weight_t> weights(1024);
+         size_t k = 0;
+         auto prob = GateMutation::from_scalar(c.prob);
+         bench.measure(c.name, 1, 1, 1, [&]() {
+            auto& weight = weights[k++ & 1023];
+            GateObject::mut_prob_t neg = prob, pos = prob;
+            if (GateObject::mutate_weight(weight, neg, pos, random)) weight = 0;
+            });
+         bench.sink = bench.sink + weights[0];
+      }
+   }
+
+   // Training with the links weights sums of the forward shall give the same weights as
+   // recomputing them in the backward
+   void check_fused_training(size_t fan_in, size_t width, size_t depth, GateWorkerPool* workers) {
+      DenseNetwork fused(fan_in, width, depth, workers);
+      DenseNetwork unfused(fan_in, width, depth, workers);
+      for (int step = 0; step < 32; step++) {
+         for (auto* net : { &fused, &unfused }) {
+            net->randomize_inputs();
+            net->model.compute_forward();
+            net->randomize_feedback(net->output());
+            if (net == &unfused) {
+               for (auto& state : net->model.context.layers) state.summed = false;
+            }
+            net->model.compute_backward();
+         }
+      }
+      for (size_t c = 0; c < fused.model.connections.size(); c++) {
+         auto& a = fused.model.connections[c]->weights;
+         auto& b = unfused.model.connections[c]->weights;
+         if (!std::equal(a.begin(), a.end(), b.begin())) {
+            fprintf(stderr, "fused training differs from unfused one: width=%zu depth=%zu fan_in=%zu\n", width, depth, fan_in);
+            exit(1);
+         }
+      }
+   }
+
+   // Connecting the same layers twice shall add both connections, as duplicated links did:
+   // with equal weights, each gate sum is its base plus twice the links sum of a single connection
+   void check_parallel_connections() {
+      GateObjectModel single, twice;
+      for (auto* model : { &single, &twice }) {
+         auto input = model->add_layer(100, 0);
+         auto output = model->add_layer(40, 1);
+         model->connect_layer(input, output);
+         if (model == &twice) model->connect_layer(input, output);
+         model->initialize();
+      }
+      auto twice_output = twice.layers[1];
+      for (auto* connection : twice_output->inputs) connection->weights = single.connections[0]->weights;
+      for (size_t i = 0; i < twice_output->size(); i++) {
+         (*twice_output)[i].gate.weight_base = (*single.layers[1])[i].gate.weight_base;
+      }
+      GateRandom random(3);
+      for (int k = 0; k < 16; k++) {
+         for (auto& word : single.context.get(single.layers[0]).states) word = random.next();
+         twice.context.get(twice.layers[0]).states = single.context.get(single.layers[0]).states;
+         single.compute_forward();
+         twice.compute_forward();
+         for (size_t i = 0; i < twice_output->size(); i++) {
+            GateObject::weight_sum_t base = (*single.layers[1])[i].gate.weight_base;
+            GateObject::weight_sum_t expected = base + 2 * (single.context.get(single.layers[1]).accumulators[i] - base);
+            if (twice.context.get(twice_output).accumulators[i] != expected) {
+               fprintf(stderr, "parallel connections do not add up: gate=%zu\n", i);
+               exit(1);
+            }
+         }
+      }
+   }
+
+   // The bit-sliced forward of a batch shall give the states of a forward per sample, also for
+   // a partial batch whose unused lanes hold garbage
+   void check_forward_batch(size_t fan_in, size_t width, size_t depth) {
+      DenseNetwork net(fan_in, width, depth, 0);
+      std::vector<GateStates> samples(64);
+      for (size_t count : { 64, 37, 1 }) {
+         auto& input_lanes = net.model.context.get(net.input).batch_states;
+         for (auto& lanes : input_lanes) lanes = net.random.next();
+         for (size_t s = 0; s < count; s++) {
+            samples[s].resize_bits(fan_in);
+            for (size_t g = 0; g < fan_in; g++) samples[s].set(g, (input_lanes[g] >> s) & 1);
+         }
+         net.model.compute_forward_batch();
+         for (size_t s = 0; s < count; s++) {
+            net.model.context.get(net.input).states = samples[s];
+            net.model.compute_forward();
+            for (auto* layer : net.model.layers) {
+               auto& lanes = net.model.context.get(layer).batch_states;
+               auto& states = net.model.context.get(layer).states;
+               for (size_t i = 0; i < layer->size(); i++) {
+                  if (((lanes[i] >> s) & 1) != uint64_t(states.get(i))) {
+                     fprintf(stderr, "batch forward differs from sample forward: width=%zu depth=%zu count=%zu sample=%zu layer=%zu\n", width, depth, count, s, layer->index);
+                     exit(1);
+                  }
+               }
+            }
+         }
+      }
+   }
+
+   void bench_models(Bench& bench, GateWorkerPool* workers) {
+      check_parallel_connections();
+      for (size_t width : { 64, 256 }) {
+         for (size_t depth : { 1, 2, 4 }) {
+            size_t fan_in = 256;
+            auto shape = get_dense_shape(fan_in, width, depth);
+            bench.measure("model.build_arena", width, depth, fan_in, [&]() {
+               GateObjectModel model(shape);
+               bench.sink = bench.sink + model.layers.size();
+               });
+            bench.measure("model.build_layers", width, depth, fan_in, [&]() {
+               GateObjectModel model;
+               for (uint32_t i = 0; i < shape.height; i++) {
+                  auto layer = model.add_layer(shape.get_layer_width(i), i);
+                  if (i > 0) model.connect_layer(model.layers[i - 1], layer);
+               }
+               model.initialize();
+               bench.sink = bench.sink + model.layers.size();
+               });
+            DenseNetwork net(fan_in, width, depth, workers);
+            bench.measure("model.estimate", width, depth, fan_in, [&]() {
+               net.randomize_inputs();
+               net.model.compute_forward();
+               bench.sink = bench.sink + net.model.context.get(net.output()).states[0];
+               });
+            bench.measure("model.estimate_delta1", width, depth, fan_in, [&]() {
+               net.flip_input();
+               net.model.compute_forward_delta();
+               bench.sink = bench.sink + net.model.context.get(net.output()).states[0];
+               });
+            bench.measure("model.train", width, depth, fan_in, [&]() {
+               net.randomize_inputs();
+               net.model.compute_forward();
+               net.randomize_feedback(net.output());
+               net.model.compute_backward();
+               });
+            check_fused_training(fan_in, width, depth, workers);
+            check_forward_batch(fan_in, width, depth);
+            bench.measure("model.train_unfused", width, depth, fan_in, [&]() {
+               net.randomize_inputs();
+               net.model.compute_forward();
+               net.randomize_feedback(net.output());
+               for (auto& state : net.model.context.layers) state.summed = false;
+               net.model.compute_backward();
+               });
+         }
+      }
+   }
+
+   // Frozen lookup forward, checked against compute_forward on every layer state before timing
+   void bench_lookup(Bench& bench) {
+      for (size_t width : { 64, 256 }) {
+         for (size_t fan_in : { 16, 256 }) {
+            size_t depth = 2;
+            DenseNetwork net(fan_in, width, depth, 0);
+            GateLookupModel lookup(net.model);
+            auto& input_states = net.model.context.get(net.input).states;
+            for (int k = 0; k < 256; k++) {
+               net.randomize_inputs();
+               net.model.compute_forward();
+               lookup.write_states(0, input_states.data());
+               lookup.compute_forward();
+               for (auto* layer : net.model.layers) {
+                  auto& states = net.model.context.get(layer).states;
+                  auto& lookup_states = lookup.layers[layer->index].states;
+                  bool equal = true;
+                  for (size_t w = 0; w < states.size(); w++) {
+                     equal = equal && (states[w] & Kernels::word_mask(w, layer->size())) == lookup_states[w];
+                  }
+                  if (!equal) {
+                     fprintf(stderr, "lookup forward differs from compute_forward: width=%zu fan_in=%zu layer=%zu\n", width, fan_in, layer->index);
+                     exit(1);
+                  }
+               }
+            }
+            bench.measure("lookup.freeze", width, depth, fan_in, [&]() {
+               lookup.freeze(net.model);
+               });
+            bench.measure("lookup.estimate", width, depth, fan_in, [&]() {
+               net.randomize_inputs();
+               lookup.write_states(0, input_states.data());
+               lookup.compute_forward();
+               bench.sink = bench.sink + lookup.layers.back().states[0];
+               });
+         }
+      }
+   }
+
+   // Generated kernel of the sample model, checked against the interpreter on all 16 bits inputs before timing
+   void bench_codegen(Bench& bench) {
+      GateObjectModel model;
+      if (!GateCheckpoint::load(model, BITMESH_CODEGEN_SAMPLE)) {
+         fprintf(stderr, "cannot load codegen sample model '%s'\n", BITMESH_CODEGEN_SAMPLE);
+         exit(1);
+      }
+      auto& context = model.context;
+      auto inputs = model.layers.front();
+      auto outputs = model.layers.back();
+      size_t width = model.layers[1]->size(), depth = model.layers.size() - 1;
+
+      uint8_t pixels[64][2];
+      uint64_t generated[codegen_sample::OutputsCount];
+      for (uint32_t base = 0; base < 1 << 16; base += 64) {
+         for (uint32_t k = 0; k < 64; k++) {
+            uint32_t value = base + k;
+            pixels[k][0] = uint8_t(value);
+            pixels[k][1] = uint8_t(value >> 8);
+            inputs->write_vec8(context, { pixels[k][0], pixels[k][1] });
+            model.compute_forward();
+            uint64_t word = value;
+            codegen_sample::forward(&word, generated);
+            if (generated[0] != context.get(outputs).states[0]) {
+               fprintf(stderr, "generated forward differs from compute_forward: input=%u\n", value);
+               exit(1);
+            }
+         }
+         inputs->write_vec8_batch(context, pixels[0], 2, 64);
+         model.compute_forward_batch();
+         codegen_sample::forward64(context.get(inputs).batch_states.data(), generated);
+         if (generated[0] != context.get(outputs).batch_states[0]) {
+            fprintf(stderr, "generated forward64 differs from compute_forward_batch: inputs=%u\n", base);
+            exit(1);
+         }
+      }
+
+      GateRandom random(1);
+      bench.measure("codegen.interpreter", width, depth, 16, [&]() {
+         auto& states = context.get(inputs).states;
+         states[0] = random.next() & 0xffff;
+         model.compute_forward();
+         bench.sink = bench.sink + context.get(outputs).states[0];
+         });
+      bench.measure("codegen.forward", width, depth, 16, [&]() {
+         uint64_t word = random.next() & 0xffff;
+         codegen_sample::forward(&word, generated);
+         bench.sink = bench.sink + generated[0];
+         });
+      uint64_t batch[codegen_sample::InputsCount];
+      bench.measure("codegen.forward64", width, depth, 16, [&]() {
+         for (auto& word : batch) word = random.next();
+         codegen_sample::forward64(batch, generated);
+         bench.sink = bench.sink + generated[0];
+         });
+   }
+
+#if INS_TELEMETRY
+   // Each forward of a model shall count one Forwards on each of its linked layers, and none on its input layer
+   void check_telemetry(GateWorkerPool* workers) {
+      DenseNetwork net(64, 256, 3, workers);
+      auto& telemetry = GateTelemetry::instance();
+      telemetry.reset();
+      const uint64_t forwards_count = 10;
+      for (uint64_t k = 0; k < forwards_count; k++) {
+         net.randomize_inputs();
+         net.model.compute_forward();
+      }
+      auto snapshot = telemetry.snapshot();
+      for (auto* layer : net.model.layers) {
+         uint64_t expected = layer->inputs.empty() ? 0 : forwards_count;
+         uint64_t count = snapshot.counters[layer->index][GateTelemetry::Forwards];
+         if (count != expected) {
+            fprintf(stderr, "telemetry forwards mismatch: layer=%zu count=%llu expected=%llu\n", layer->index, (unsigned long long)count, (unsigned long long)expected);
+            exit(1);
+         }
+      }
+   }
+#endif
+
+   // Count heap allocations of 'steps' calls of step(), after as many warm-up calls, and exit when any
+   template <class Fn>
+   void check_allocations(const char* name, size_t steps, Fn step) {
+      for (size_t k = 0; k < steps; k++) step();
+      uint64_t before = allocations_count.load(std::memory_order_relaxed);
+      for (size_t k = 0; k < steps; k++) step();
+      uint64_t count = allocations_count.load(std::memory_order_relaxed) - before;
+      if (count) {
+         fprintf(stderr, "%s allocates: %llu allocations in %zu steps\n", name, (unsigned long long)count, steps);
+         exit(1);
+      }
+   }
+
+   // Training and inference steps of every model kind shall not allocate once warm
+   void bench_allocations(GateWorkerPool* workers) {
+      // Over-aligned allocations shall be counted as the others
+      struct alignas(64) Line {
+         uint64_t words[8];
+      };
+      static Line* volatile line;
+      uint64_t before = allocations_count.load(std::memory_order_relaxed);
+      line = new Line();
+      delete line;
+      if (allocations_count.load(std::memory_order_relaxed) == before) {
+         fprintf(stderr, "over-aligned allocations are not counted\n");
+         exit(1);
+      }
+
+      GateRandom random(1);
+      auto pixel = [&](uint8_t& i, uint8_t& j) {
+         i = random.next_u32() % 32;
+         j = random.next_u32() % 32;
+      };
+      auto check_image_model = [&](const char* name, IImage2DTrainable& model) {
+         uint8_t pixels[64][2] = {};
+         check_allocations(name, 1000, [&]() {
+            uint8_t i, j;
+            pixel(i, j);
+            model.train_pixel(i, j, (-2 * int(i) - int(j)) < -40);
+            model.estimate_pixel(j, i);
+            model.estimate_pixels(pixels, 64);
+            });
+      };
+      Models::SingleGateImage2DModel single;
+      Models::HiddenLayerImage2DModel hidden;
+      Models::StaticHiddenLayerImage2DModel static_hidden;
+      check_image_model("image.single", single);
+      check_image_model("image.hidden", hidden);
+      check_image_model("image.static_hidden", static_hidden);
+
+      DenseNetwork net(256, 256, 2, workers);
+      check_allocations("model.train", 100, [&]() {
+         net.randomize_inputs();
+         net.model.compute_forward();
+         net.randomize_feedback(net.output());
+         net.model.compute_backward();
+         net.flip_input();
+         net.model.compute_forward_delta();
+         });
+
+      MNIST::GateClassifier classifier;
+      std::vector<uint8_t> image(MNIST::GateClassifier::PixelsCount);
+      check_allocations("mnist.train", 20, [&]() {
+         for (auto& value : image) value = uint8_t(random.next_u32());
+         classifier.train(classifier.model.context, image, uint8_t(random.next_u32() % 10));
+         });
+
+      GateLookupModel lookup(net.model);
+      check_allocations("lookup.estimate", 100, [&]() {
+         lookup.write_states(0, net.model.context.get(net.input).states.data());
+         lookup.compute_forward();
+         });
+
+      Models::HiddenLayerImage2DPopulation population;
+      for (size_t k = 0; k < 20; k++) population.add("halfspace", single, GateRandom::DefaultSeed + k);
+      population.workers = workers;
+      check_allocations("population.train", 100, [&]() {
+         population.train(1);
+         });
+   }
+
+   // Halfspace reference image of the population cases
+   struct HalfspaceImage : IImage2DModel {
+      int a, b, c;
+      HalfspaceImage(int a, int b, int c) : a(a), b(b), c(c) {
+      }
+      bool estimate_pixel(uint8_t i, uint8_t j) override {
+         return (a * int(i) + b * int(j)) < c;
+      }
+   };
+
+   // Population training of 64 models, against 64 static models of the same topology, after checking
+   // that population lanes train exactly as static networks of the same seeds
+   void bench_population(Bench& bench, GateWorkerPool* workers) {
+      typedef Models::HiddenLayerImage2DPopulation population_t;
+      typedef StaticGateNetwork<16, 4, 1> network_t;
+      HalfspaceImage targets[] = { { 2, -1, 8 }, { -2, -1, -40 }, { 1, -2, 2 }, { -1, 3, -16 } };
+      const size_t models_count = 64;
+
+      population_t population;
+      population.workers = workers;
+      for (size_t k = 0; k < models_count; k++) {
+         population.add("halfspace", targets[k % 4], GateRandom::DefaultSeed + k, k % 3 ? 1.0f : 0.5f);
+      }
+
+      {
+         population_t checked;
+         std::vector<network_t> networks;
+         for (size_t k = 0; k < 20; k++) {
+            checked.add("halfspace", targets[k % 4], GateRandom::DefaultSeed + k, k % 3 ? 1.0f : 0.5f);
+            networks.emplace_back(GateRandom::DefaultSeed + k);
+         }
+         checked.train(2000);
+         for (size_t b = 0; b < checked.blocks.size(); b++) {
+            GateRandom random = GateRandom(GateRandom::DefaultSeed + 0x9e3779b97f4a7c15ull * (b + 1));
+            for (size_t s = 0; s < 2000; s++) {
+               uint64_t i = random.next_u32() % 32, j = random.next_u32() % 32;
+               uint64_t inputs = i | (j << 8);
+               for (size_t k = b * population_t::Lanes; k < std::min(networks.size(), (b + 1) * population_t::Lanes); k++) {
+                  auto& network = networks[k];
+                  network.write_inputs(&inputs);
+                  network.compute_forward();
+                  bool correct = network.get_output(0) == checked.members[k].target.get(int(i), int(j));
+                  Scalar feedback = checked.members[k].feedback;
+                  network.emit_feedback(0, correct ? feedback : -feedback);
+                  network.compute_backward();
+               }
+            }
+         }
+         for (size_t k = 0; k < networks.size(); k++) {
+            auto& block = checked.blocks[k / population_t::Lanes];
+            size_t m = k % population_t::Lanes;
+            bool equal = true;
+            for (size_t l = 0; l < network_t::LinksCount; l++) equal = equal && networks[k].weights[l] == block.weights[l * population_t::Lanes + m];
+            for (size_t g = 0; g < network_t::GatesCount; g++) equal = equal && networks[k].gates[g].gate.weight_base == block.weight_base[g * population_t::Lanes + m];
+            if (!equal) {
+               fprintf(stderr, "population model %zu differs from its static network\n", k);
+               exit(1);
+            }
+         }
+      }
+
+      bench.measure("population.train64", 4, 2, 16, [&]() {
+         population.train(1);
+         });
+      std::vector<Models::StaticHiddenLayerImage2DModel> models;
+      for (size_t k = 0; k < models_count; k++) models.emplace_back(GateRandom::DefaultSeed + k);
+      GateRandom random(1);
+      bench.measure("population.static_train64", 4, 2, 16, [&]() {
+         uint8_t i = random.next_u32() % 32, j = random.next_u32() % 32;
+         for (size_t k = 0; k < models_count; k++) models[k].train_pixel(i, j, targets[k % 4].estimate_pixel(i, j));
+         });
+      bench.measure("population.evaluate64", 4, 2, 16, [&]() {
+         bench.sink = bench.sink + population.evaluate()[0];
+         });
+   }
+
+   // Checkpoint save, restore into a fresh model, and open for mapped inference
+   // Image-scale network of sparse links: a 28x28 input read by 2 maps of 5x5 windows, 256 gates of 64 random
+   // links to them plus 12x12 windows and a skip connection from the input, then 10 outputs.
+   // When 'dense', the same layers are fully connected instead.
+   struct SparseNetwork {
+      GateObjectModel model;
+      GateLayer* input;
+      GateLayer* local;
+      GateLayer* hidden;
+      GateLayer* output;
+      GateRandom random;
+
+      SparseNetwork(bool dense, GateWorkerPool* workers) : random(1) {
+         input = model.add_layer(28 * 28, 0);
+         local = model.add_layer(2 * 24 * 24, 1);
+         hidden = model.add_layer(256, 2);
+         output = model.add_layer(10, 3);
+         auto connect = [&](GateLayer* from, GateLayer* to, const GateLinks& links) {
+            model.connect_layer(from, to, dense ? GateLinks::dense(from->size()) : links);
+         };
+         connect(input, local, GateLinks::local(28, 28, 5));
+         connect(local, hidden, GateLinks::random(local->size(), 64));
+         connect(input, hidden, GateLinks::local(28, 28, 12, 16));
+         connect(input, hidden, GateLinks::skip(input->size()));
+         connect(hidden, output, GateLinks::dense(hidden->size()));
+         model.initialize();
+         model.set_workers(workers);
+      }
+      void randomize_inputs() {
+         auto& state = model.context.get(input);
+         for (size_t w = 0; w < state.states.size(); w++) {
+            uint64_t word = random.next();
+            state.changes[w] |= state.states[w] ^ word;
+            state.states[w] = word;
+         }
+      }
+      void flip_input() {
+         auto& state = model.context.get(input);
+         size_t k = random.next() % input->size();
+         state.states[k >> 6] ^= uint64_t(1) << (k & 63);
+         state.changes[k >> 6] ^= uint64_t(1) << (k & 63);
+      }
+      // Copy the weights of 'sparse' to this dense network, links missing from the sparse one weighing 0
+      void copy_weights(const SparseNetwork& sparse) {
+         for (size_t l = 0; l < model.layers.size(); l++) {
+            for (size_t i = 0; i < model.layers[l]->size(); i++) {
+               (*model.layers[l])[i].gate.weight_base = (*sparse.model.layers[l])[i].gate.weight_base;
+            }
+         }
+         for (size_t c = 0; c < model.connections.size(); c++) {
+            auto from = sparse.model.connections[c];
+            auto to = model.connections[c];
+            std::fill(to->weights.begin(), to->weights.end(), 0);
+            for (size_t i = 0; i < from->height; i++) {
+               for (size_t k = 0; k < from->width; k++) {
+                  to->weights[i * to->width + from->get_source(i, k)] = from->weights[i * from->width + k];
+               }
+            }
+         }
+      }
+   };
+
+   bool equal_states(const uint64_t* a, const uint64_t* b, size_t count) {
+      for (size_t w = 0; w * 64 < count; w++) {
+         if ((a[w] ^ b[w]) & Kernels::word_mask(w, count)) return false;
+      }
+      return true;
+   }
+
+   // Hogwild training of a model on 1 thread, then on several threads sharing its parameters:
+   // the model shall learn as well within a bound, and the trainer throughput is recorded per sample
+   void bench_hogwild(Bench& bench) {
+      typedef Models::SingleGateImage2DModel model_t;
+      HalfspaceImage target(-2, -1, -40);
+      size_t threads_max = std::max<size_t>({ std::thread::hardware_concurrency(), bench.workers_count, 2 });
+      const size_t samples_count = 200000;
+      size_t single_matches = 0;
+      for (size_t threads_count : { size_t(1), threads_max }) {
+         model_t model;
+         GateHogwildTrainer<model_t> trainer(model, threads_count);
+         auto report = trainer.train(samples_count, [&](GateRandom& random, uint8_t& i, uint8_t& j, bool& expected) {
+            i = random.next_u32() % 32;
+            j = random.next_u32() % 32;
+            expected = target.estimate_pixel(i, j);
+            });
+         size_t matches = 0;
+         for (int i = 0; i < 32; i++) {
+            for (int j = 0; j < 32; j++) matches += model.estimate_pixel(i, j) == target.estimate_pixel(i, j);
+         }
+         fprintf(stderr, "hogwild threads=%zu samples/sec=%.0f accuracy=%zu/1024\n", report.threads_count, report.samples_per_second(), matches);
+         if (threads_count == 1) single_matches = matches;
+         if (matches < 940 || matches + 64 < single_matches) {
+            fprintf(stderr, "hogwild training accuracy too low: threads=%zu accuracy=%zu/1024 single=%zu/1024\n", threads_count, matches, single_matches);
+            exit(1);
+         }
+         bench.record("hogwild.train_pixel.t" + std::to_string(threads_count), 1, 1, 16, samples_count, report.seconds);
+      }
+   }
+
+   void bench_sparse(Bench& bench, GateWorkerPool* workers) {
+      SparseNetwork sparse(false, workers);
+      SparseNetwork dense(true, workers);
+      dense.copy_weights(sparse);
+      size_t width = sparse.local->size(), depth = 3, fan_in = sparse.input->size();
+
+      // Sparse links shall evaluate as dense links of weight 0 where not linked, and the delta,
+      // lookup and mapped forwards as the full one
+      GateContext reference = sparse.model.create_context(GateRandom(1));
+      const char* path = "bitmesh-bench-sparse.ckpt";
+      if (!GateCheckpoint::save(sparse.model, path)) {
+         fprintf(stderr, "cannot save sparse model to '%s'\n", path);
+         exit(1);
+      }
+      MappedGateModel mapped(path);
+      GateLookupModel lookup(sparse.model);
+      for (int k = 0; k < 256; k++) {
+         if (k % 16 == 0) sparse.randomize_inputs();
+         else sparse.flip_input();
+         auto& input_states = sparse.model.context.get(sparse.input).states;
+         std::copy(input_states.begin(), input_states.end(), reference.get(sparse.input).states.begin());
+         std::copy(input_states.begin(), input_states.end(), dense.model.context.get(dense.input).states.begin());
+         mapped.write_states(0, input_states.data());
+         lookup.write_states(0, input_states.data());
+         sparse.model.compute_forward_delta();
+         sparse.model.compute_forward(reference);
+         dense.model.compute_forward();
+         mapped.compute_forward();
+         lookup.compute_forward();
+         for (auto* layer : sparse.model.layers) {
+            auto states = reference.get(layer).states.data();
+            const char* mismatch = 0;
+            if (!equal_states(states, dense.model.context.get(dense.model.layers[layer->index]).states.data(), layer->size())) mismatch = "dense links";
+            if (!equal_states(states, sparse.model.context.get(layer).states.data(), layer->size())) mismatch = "delta forward";
+            if (!equal_states(states, mapped.states[layer->index].data(), layer->size())) mismatch = "mapped forward";
+            if (!equal_states(states, lookup.layers[layer->index].states.data(), layer->size())) mismatch = "lookup forward";
+            if (mismatch) {
+               fprintf(stderr, "sparse forward differs from %s: layer=%zu\n", mismatch, layer->index);
+               exit(1);
+            }
+         }
+      }
+      remove(path);
+
+      bench.measure("sparse.estimate", width, depth, fan_in, [&]() {
+         sparse.randomize_inputs();
+         sparse.model.compute_forward();
+         bench.sink = bench.sink + sparse.model.context.get(sparse.output).states[0];
+         });
+      bench.measure("sparse.estimate_delta1", width, depth, fan_in, [&]() {
+         sparse.flip_input();
+         sparse.model.compute_forward_delta();
+         bench.sink = bench.sink + sparse.model.context.get(sparse.output).states[0];
+         });
+      bench.measure("sparse.train", width, depth, fan_in, [&]() {
+         sparse.randomize_inputs();
+         sparse.model.compute_forward();
+         auto& signals = sparse.model.context.get(sparse.output).feedback_signals;
+         for (auto& signal : signals) signal = (sparse.random.next() >> 63) ? 1.0f : -1.0f;
+         sparse.model.compute_backward();
+         });
+      bench.measure("sparse.dense_estimate", width, depth, fan_in, [&]() {
+         dense.randomize_inputs();
+         dense.model.compute_forward();
+         bench.sink = bench.sink + dense.model.context.get(dense.output).states[0];
+         });
+      bench.measure("sparse.dense_train", width, depth, fan_in, [&]() {
+         dense.randomize_inputs();
+         dense.model.compute_forward();
+         auto& signals = dense.model.context.get(dense.output).feedback_signals;
+         for (auto& signal : signals) signal = (dense.random.next() >> 63) ? 1.0f : -1.0f;
+         dense.model.compute_backward();
+         });
+   }
+   // Convolutional network: a 28x28 input read by 8 maps sharing one 5x5 kernel each, then 10 outputs.
+   // When not 'shared', each position has its own copy of the kernel instead, see copy_kernels.
+   struct ConvNetwork {
+      GateObjectModel model;
+      GateLayer* input;
+      GateLayer* maps;
+      GateLayer* output;
+      GateRandom random;
+
+      ConvNetwork(bool shared, GateWorkerPool* workers) : random(2) {
+         input = model.add_layer(28 * 28, 0);
+         if (shared) {
+            maps = model.add_convolution_layer(input, 28, 28, 8, 5, 1, 1);
+         }
+         else {
+            maps = model.add_layer(8 * 24 * 24, 1);
+            model.connect_layer(input, maps, GateLinks::local(28, 28, 5));
+         }
+         output = model.add_layer(10, 2);
+         model.connect_layer(maps, output);
+         model.initialize();
+         model.set_workers(workers);
+      }
+      void randomize_inputs() {
+         auto& state = model.context.get(input);
+         for (size_t w = 0; w < state.states.size(); w++) {
+            uint64_t word = random.next();
+            state.changes[w] |= state.states[w] ^ word;
+            state.states[w] = word;
+         }
+      }
+      void flip_input() {
+         auto& state = model.context.get(input);
+         size_t k = random.next() % input->size();
+         state.states[k >> 6] ^= uint64_t(1) << (k & 63);
+         state.changes[k >> 6] ^= uint64_t(1) << (k & 63);
+      }
+      // Copy the parameters of 'shared' to this network, the kernel of a map to each of its positions
+      void copy_kernels(const ConvNetwork& shared) {
+         for (size_t l = 0; l < model.layers.size(); l++) {
+            for (size_t i = 0; i < model.layers[l]->size(); i++) {
+               (*model.layers[l])[i].gate.weight_base = (*shared.model.layers[l])[i].gate.weight_base;
+            }
+         }
+         for (size_t c = 0; c < model.connections.size(); c++) {
+            auto from = shared.model.connections[c];
+            auto to = model.connections[c];
+            for (size_t i = 0; i < to->height; i++) {
+               std::copy(from->get_row_weights(i), from->get_row_weights(i) + from->width, &to->weights[i * to->width]);
+            }
+         }
+      }
+      void train() {
+         model.compute_forward();
+         auto& signals = model.context.get(output).feedback_signals;
+         for (auto& signal : signals) signal = (random.next() >> 63) ? 1.0f : -1.0f;
+         model.compute_backward();
+      }
+   };
+
+   // An overflow in a shared map shall downscale its kernel once and the biases of all its gates,
+   // whether the kernel or a gate bias overflowed, and leave the other maps unchanged
+   void check_shared_downscale() {
+      for (bool kernel_overflow : { true, false }) {
+         GateObjectModel model;
+         auto input = model.add_layer(8 * 8, 0);
+         auto maps = model.add_convolution_layer(input, 8, 8, 2, 3, 1, 1);
+         model.initialize();
+         auto kernel = maps->inputs[0];
+         size_t positions = kernel->links.get_positions_count();
+         std::fill(kernel->mut_prob_neg.begin(), kernel->mut_prob_neg.end(), 0);
+         std::fill(kernel->mut_prob_pos.begin(), kernel->mut_prob_pos.end(), 0);
+         for (size_t i = 0; i < maps->size(); i++) {
+            (*maps)[i].gate.mut_prob_neg = (*maps)[i].gate.mut_prob_pos = 0;
+         }
+
+         // Overflow the first link of map 0, or the bias of a gate of map 1 which is not its first
+         // The overflowed weight steps past WeightMax before its downscale
+         size_t map = kernel_overflow ? 0 : 1;
+         size_t overflowed_gate = positions + 5;
+         auto weights = kernel->weights;
+         std::vector<GateObject::weight_t> biases(maps->size());
+         for (size_t i = 0; i < maps->size(); i++) biases[i] = (*maps)[i].gate.weight_base;
+         if (kernel_overflow) {
+            kernel->weights[0] = GateObject::WeightMax;
+            kernel->mut_prob_pos[0] = GateMutation::ProbOne;
+            weights[0] = GateObject::WeightMax + 1;
+         }
+         else {
+            (*maps)[overflowed_gate].gate.weight_base = GateObject::WeightMax;
+            (*maps)[overflowed_gate].gate.mut_prob_pos = GateMutation::ProbOne;
+            biases[overflowed_gate] = GateObject::WeightMax + 1;
+         }
+
+#if INS_TELEMETRY
+         uint64_t downscales_count = GateTelemetry::instance().snapshot().counters[maps->index][GateTelemetry::Downscales];
+#endif
+         model.compute_forward();
+         model.compute_backward();
+#if INS_TELEMETRY
+         if (GateTelemetry::instance().snapshot().counters[maps->index][GateTelemetry::Downscales] == downscales_count) {
+            fprintf(stderr, "shared map downscale not counted: overflow=%s layer=%zu\n", kernel_overflow ? "kernel" : "bias", maps->index);
+            exit(1);
+         }
+#endif
+         for (size_t k = 0; k < weights.size(); k++) {
+            bool downscaled = k / kernel->width == map;
+            if (kernel->weights[k] != (downscaled ? GateObject::downscale_weight(weights[k]) : weights[k])) {
+               fprintf(stderr, "shared kernel downscale mismatch: overflow=%s link=%zu\n", kernel_overflow ? "kernel" : "bias", k);
+               exit(1);
+            }
+         }
+         for (size_t i = 0; i < maps->size(); i++) {
+            bool downscaled = i / positions == map;
+            if ((*maps)[i].gate.weight_base != (downscaled ? GateObject::downscale_weight(biases[i]) : biases[i])) {
+               fprintf(stderr, "shared map bias downscale mismatch: overflow=%s gate=%zu\n", kernel_overflow ? "kernel" : "bias", i);
+               exit(1);
+            }
+         }
+      }
+   }
+
+   void bench_convolution(Bench& bench, GateWorkerPool* workers) {
+      check_shared_downscale();
+
+      ConvNetwork conv(true, workers);
+      ConvNetwork local(false, workers);
+      size_t width = conv.maps->size(), depth = 2, fan_in = 25;
+
+      // Shared kernels shall evaluate as their copies at each position, and the delta, lookup,
+      // mapped and restored forwards as the full one, also once trained
+      const char* path = "bitmesh-bench-conv.ckpt";
+      for (int round = 0; round < 2; round++) {
+         if (round) {
+            for (int k = 0; k < 64; k++) {
+               conv.randomize_inputs();
+               conv.train();
+            }
+         }
+         local.copy_kernels(conv);
+         GateContext reference = conv.model.create_context(GateRandom(1));
+         GateObjectModel restored;
+         if (!GateCheckpoint::save(conv.model, path) || !GateCheckpoint::load(restored, path)) {
+            fprintf(stderr, "cannot save and restore convolutional model with '%s'\n", path);
+            exit(1);
+         }
+         MappedGateModel mapped(path);
+         GateLookupModel lookup(conv.model);
+         for (int k = 0; k < 64; k++) {
+            if (k % 16 == 0) conv.randomize_inputs();
+            else conv.flip_input();
+            auto& input_states = conv.model.context.get(conv.input).states;
+            std::copy(input_states.begin(), input_states.end(), reference.get(conv.input).states.begin());
+            std::copy(input_states.begin(), input_states.end(), local.model.context.get(local.input).states.begin());
+            std::copy(input_states.begin(), input_states.end(), restored.context.get(restored.layers[0]).states.begin());
+            mapped.write_states(0, input_states.data());
+            lookup.write_states(0, input_states.data());
+            conv.model.compute_forward_delta();
+            conv.model.compute_forward(reference);
+            local.model.compute_forward();
+            restored.compute_forward();
+            mapped.compute_forward();
+            lookup.compute_forward();
+            for (auto* layer : conv.model.layers) {
+               auto states = reference.get(layer).states.data();
+               const char* mismatch = 0;
+               if (!equal_states(states, local.model.context.get(local.model.layers[layer->index]).states.data(), layer->size())) mismatch = "local links";
+               if (!equal_states(states, conv.model.context.get(layer).states.data(), layer->size())) mismatch = "delta forward";
+               if (!equal_states(states, restored.context.get(restored.layers[layer->index]).states.data(), layer->size())) mismatch = "restored forward";
+               if (!equal_states(states, mapped.states[layer->index].data(), layer->size())) mismatch = "mapped forward";
+               if (!equal_states(states, lookup.layers[layer->index].states.data(), layer->size())) mismatch = "lookup forward";
+               if (mismatch) {
+                  fprintf(stderr, "convolution forward differs from %s: round=%d layer=%zu\n", mismatch, round, layer->index);
+                  exit(1);
+               }
+            }
+         }
+      }
+      remove(path);
+
+      bench.measure("conv.estimate", width, depth, fan_in, [&]() {
+         conv.randomize_inputs();
+         conv.model.compute_forward();
+         bench.sink = bench.sink + conv.model.context.get(conv.output).states[0];
+         });
+      bench.measure("conv.estimate_delta1", width, depth, fan_in, [&]() {
+         conv.flip_input();
+         conv.model.compute_forward_delta();
+         bench.sink = bench.sink + conv.model.context.get(conv.output).states[0];
+         });
+      bench.measure("conv.train", width, depth, fan_in, [&]() {
+         conv.randomize_inputs();
+         conv.train();
+         });
+      bench.measure("conv.local_estimate", width, depth, fan_in, [&]() {
+         local.randomize_inputs();
+         local.model.compute_forward();
+         bench.sink = bench.sink + local.model.context.get(local.output).states[0];
+         });
+      bench.measure("conv.local_train", width, depth, fan_in, [&]() {
+         local.randomize_inputs();
+         local.train();
+         });
+   }
+   // Checkpoints whose offsets are misaligned, or wrap the file bound once added to their arrays size, shall not load
+   void check_corrupt_checkpoints(const char* path) {
+      GateObjectModel model(get_dense_shape(64, 64, 2));
+      if (!GateCheckpoint::save(model, path)) {
+         fprintf(stderr, "cannot save model to '%s'\n", path);
+         exit(1);
+      }
+      std::vector<char> bytes;
+      {
+         MappedFile file(path);
+         bytes.assign((const char*)file.data, (const char*)file.data + file.size);
+      }
+      auto header = (const GateCheckpoint::Header*)bytes.data();
+      size_t record_offset = size_t(header->connections_offset);
+      auto record = (const GateCheckpoint::ConnectionRecord*)(bytes.data() + record_offset);
+      uint64_t weights_size = model.connections[0]->weights.size() * sizeof(GateObject::weight_t);
+      typedef uint64_t GateCheckpoint::ConnectionRecord::* field_t;
+      struct Corruption { field_t field; uint64_t offset; };
+      Corruption corruptions[] = {
+         { &GateCheckpoint::ConnectionRecord::mut_prob_neg_offset, record->mut_prob_neg_offset + 1 },
+         { &GateCheckpoint::ConnectionRecord::weights_offset, ~uint64_t(0) - weights_size + 65 },
+      };
+      for (auto corruption : corruptions) {
+         std::vector<char> corrupt = bytes;
+         ((GateCheckpoint::ConnectionRecord*)(corrupt.data() + record_offset))->*corruption.field = corruption.offset;
+         FILE* file = fopen(path, "wb");
+         bool written = file && fwrite(corrupt.data(), 1, corrupt.size(), file) == corrupt.size();
+         if (file) fclose(file);
+         GateObjectModel loaded;
+         if (!written || GateCheckpoint::load(loaded, path) || MappedGateModel(path).is_open()) {
+            fprintf(stderr, "corrupt checkpoint accepted: offset %llu\n", (unsigned long long)corruption.offset);
+            exit(1);
+         }
+      }
+   }
+   void bench_checkpoint(Bench& bench) {
+      const char* path = "bitmesh-bench.ckpt";
+      check_corrupt_checkpoints(path);
+      for (size_t width : { 64, 256 }) {
+         size_t fan_in = 256, depth = 2;
+         GateObjectModel model(get_dense_shape(fan_in, width, depth));
+         bench.measure("checkpoint.save", width, depth, fan_in, [&]() {
+            bench.sink = bench.sink + GateCheckpoint::save(model, path);
+            });
+         bench.measure("checkpoint.load", width, depth, fan_in, [&]() {
+            GateObjectModel loaded;
+            bench.sink = bench.sink + GateCheckpoint::load(loaded, path);
+            });
+         bench.measure("checkpoint.map", width, depth, fan_in, [&]() {
+            MappedGateModel mapped(path);
+            bench.sink = bench.sink + mapped.is_open();
+            });
+      }
+      remove(path);
+   }
+
+   // Write an IDX file of unsigned bytes, of 'count' samples of 'sizes'
+   void write_idx(const std::string& path, uint32_t count, std::vector<uint32_t> sizes, const std::vector<uint8_t>& datas) {
+      std::vector<uint8_t> bytes = { 0, 0, MNIST::UByteTensorFile::UByteType, uint8_t(sizes.size() + 1) };
+      sizes.insert(sizes.begin(), count);
+      for (uint32_t size : sizes) {
+         for (int shift = 24; shift >= 0; shift -= 8) bytes.push_back(uint8_t(size >> shift));
+      }
+      bytes.insert(bytes.end(), datas.begin(), datas.end());
+      FILE* file = fopen(path.c_str(), "wb");
+      if (!file || fwrite(bytes.data(), 1, bytes.size(), file) != bytes.size()) {
+         fprintf(stderr, "cannot write IDX file '%s'\n", path.c_str());
+         exit(1);
+      }
+      fclose(file);
+   }
+
+   // MNIST::run shall train and evaluate over synthetic IDX files, save its checkpoint, then resume from it
+   void check_mnist_run() {
+      const char* dir = "bitmesh-bench-mnist";
+      std::string checkpoint_path = std::string(dir) + "/classifier.ckpt";
+      std::filesystem::remove_all(dir);
+      std::filesystem::create_directory(dir);
+      GateRandom random(1);
+      for (auto set : { std::make_pair("train", 256u), std::make_pair("t10k", 64u) }) {
+         std::vector<uint8_t> images(set.second * MNIST::GateClassifier::PixelsCount), labels(set.second);
+         for (auto& pixel : images) pixel = uint8_t(random.next_u32());
+         for (auto& label : labels) label = uint8_t(random.next_u32() % MNIST::GateClassifier::ClassesCount);
+         write_idx(std::string(dir) + "/" + set.first + "-images.idx3-ubyte", set.second, { 28, 28 }, images);
+         write_idx(std::string(dir) + "/" + set.first + "-labels.idx1-ubyte", set.second, {}, labels);
+      }
+
+      // Truncated files, and headers whose sizes product wraps, eg. 2^31 samples of 2^17 x 2^16, shall not open
+      std::string corrupt_path = std::string(dir) + "/corrupt.idx3-ubyte";
+      std::vector<uint8_t> sample(MNIST::GateClassifier::PixelsCount);
+      for (auto header : { std::make_pair(2u, std::vector<uint32_t>{ 28, 28 }), std::make_pair(1u << 31, std::vector<uint32_t>{ 1u << 17, 1u << 16 }) }) {
+         write_idx(corrupt_path, header.first, header.second, sample);
+         if (MNIST::UByteTensorFile(corrupt_path).is_open()) {
+            fprintf(stderr, "corrupt IDX header opened: count=%u\n", header.first);
+            exit(1);
+         }
+      }
+      for (bool resumed : { false, true }) {
+         FILE* log = tmpfile();
+         if (!log || MNIST::run(dir, 1, 2, checkpoint_path.c_str(), log) != 0) {
+            fprintf(stderr, "MNIST run failed over '%s'\n", dir);
+            exit(1);
+         }
+         std::string text(size_t(ftell(log)), 0);
+         rewind(log);
+         text.resize(fread(&text[0], 1, text.size(), log));
+         fclose(log);
+         if ((text.find("> resumed from") != std::string::npos) != resumed || text.find("> epoch 1") == std::string::npos) {
+            fprintf(stderr, "MNIST run %s resume from '%s':\n%s", resumed ? "did not" : "shall not", checkpoint_path.c_str(), text.c_str());
+            exit(1);
+         }
+      }
+      std::filesystem::remove_all(dir);
+   }
+
+   // Binarization and classification of 28x28 samples, over the MNIST training set when --mnist is given
+   void bench_mnist(Bench& bench) {
+      check_mnist_run();
+
+      const size_t pixels_count = MNIST::GateClassifier::PixelsCount;
+      const auto& shape = MNIST::GateClassifier::DefaultShape;
+      MNIST::GateClassifier classifier;
+      auto& context = classifier.model.context;
+
+      // Random samples, unless the training set is given
+      GateRandom random(1);
+      std::vector<uint8_t> pixels(pixels_count * 64);
+      for (auto& pixel : pixels) pixel = uint8_t(random.next_u32());
+      MNIST::Dataset dataset;
+      if (bench.mnist_dir) {
+         std::string dir = bench.mnist_dir;
+         bench.measure("mnist.open", pixels_count, 1, 1, [&]() {
+            if (!dataset.open(dir, "train")) {
+               fprintf(stderr, "cannot open MNIST training set in %s\n", dir.c_str());
+               exit(1);
+            }
+            bench.sink = bench.sink + dataset.size();
+            });
+      }
+      size_t k = 0;
+      auto next_image = [&]() {
+         if (dataset.size()) return dataset.images.get(k++ % dataset.size());
+         return MNIST::ByteView{ &pixels[(k++ & 63) * pixels_count], pixels_count };
+      };
+      auto get_label = [&](size_t index) {
+         return dataset.size() ? dataset.labels.get_label(index % dataset.size()) : uint8_t(index % 10);
+      };
+
+      bench.measure("mnist.binarize", pixels_count, 1, 1, [&]() {
+         MNIST::write_binarized(&classifier.inputs, context, next_image());
+         bench.sink = bench.sink + context.get(&classifier.inputs).states[0];
+         });
+      bench.measure("mnist.estimate", shape.internal_width, shape.height - 1, pixels_count, [&]() {
+         bench.sink = bench.sink + classifier.estimate(context, next_image());
+         });
+      bench.measure("mnist.train", shape.internal_width, shape.height - 1, pixels_count, [&]() {
+         uint8_t label = get_label(k);
+         bench.sink = bench.sink + classifier.train(context, next_image(), label);
+         });
+   }
+
+   // A static network and a dynamic model of the same topology and seed shall train bit-identically:
+   // same outputs while training, then same gates, weights and mutation probabilities
+   template <class Static, class Dynamic>
+   void check_static_training(const char* name, size_t samples_count) {
+      Static static_model;
+      Dynamic dynamic_model;
+      GateRandom random(1);
+      for (size_t k = 0; k < samples_count; k++) {
+         uint8_t i = random.next_u32() % 32, j = random.next_u32() % 32;
+         bool expected = (-2 * int(i) - int(j)) < -40;
+         if (static_model.train_pixel(i, j, expected) != dynamic_model.train_pixel(i, j, expected)) {
+            fprintf(stderr, "%s static training output differs from dynamic one: sample=%zu\n", name, k);
+            exit(1);
+         }
+      }
+      auto& network = static_model.network;
+      auto& model = dynamic_model.model;
+      bool equal = true;
+      for (auto* layer : model.layers) {
+         if (layer->index == 0) continue;
+         auto* gates = &network.gates[network.get_gates_offset(layer->index)];
+         for (size_t i = 0; i < layer->size(); i++) {
+            auto& a = (*layer)[i].gate;
+            auto& b = gates[i].gate;
+            equal = equal && a.weight_base == b.weight_base && a.mut_prob_neg == b.mut_prob_neg && a.mut_prob_pos == b.mut_prob_pos;
+         }
+      }
+      for (auto* connection : model.connections) {
+         size_t offset = network.get_links_offset(connection->target->index);
+         equal = equal && std::equal(connection->weights.begin(), connection->weights.end(), &network.weights[offset])
+            && std::equal(connection->mut_prob_neg.begin(), connection->mut_prob_neg.end(), &network.mut_prob_neg[offset])
+            && std::equal(connection->mut_prob_pos.begin(), connection->mut_prob_pos.end(), &network.mut_prob_pos[offset]);
+      }
+      for (int i = 0; i < 32; i++) {
+         for (int j = 0; j < 32; j++) equal = equal && static_model.estimate_pixel(i, j) == dynamic_model.estimate_pixel(i, j);
+      }
+      if (!equal) {
+         fprintf(stderr, "%s static network differs from dynamic model after %zu samples\n", name, samples_count);
+         exit(1);
+      }
+   }
+
+   template <class Model>
+   void bench_image_model(Bench& bench, const char* name, size_t width, size_t depth) {
+      Model model;
+      GateRandom random(1);
+      std::string prefix = std::string("image.") + name;
+
+      // Batches of pixels shall estimate as pixels one by one, including partial batches, before and after training
+      uint8_t batch[64][2];
+      for (int round = 0; round < 2; round++) {
+         for (int k = 0; round && k < 10000; k++) {
+            uint8_t i = random.next_u32() % 32, j = random.next_u32() % 32;
+            model.train_pixel(i, j, (-2 * int(i) - int(j)) < -40);
+         }
+         for (int count : { 64, 37, 1 }) {
+            uint64_t expected = 0;
+            for (int k = 0; k < count; k++) {
+               batch[k][0] = random.next_u32() % 32;
+               batch[k][1] = random.next_u32() % 32;
+               expected |= uint64_t(model.estimate_pixel(batch[k][0], batch[k][1])) << k;
+            }
+            if (model.estimate_pixels(batch, count) != expected) {
+               fprintf(stderr, "%s batch estimate differs from pixel estimates: count=%d round=%d\n", prefix.c_str(), count, round);
+               exit(1);
+            }
+         }
+      }
+      bench.measure(prefix + ".train_pixel", width, depth, 16, [&]() {
+         uint8_t i = random.next_u32() % 32, j = random.next_u32() % 32;
+         model.train_pixel(i, j, (-2 * int(i) - int(j)) < -40);
+         });
+      bench.measure(prefix + ".estimate_pixel", width, depth, 16, [&]() {
+         uint8_t i = random.next_u32() % 32, j = random.next_u32() % 32;
+         bench.sink = bench.sink + model.estimate_pixel(i, j);
+         });
+      size_t sweep = 0;
+      bench.measure(prefix + ".estimate_pixel_sweep", width, depth, 16, [&]() {
+         bench.sink = bench.sink + model.estimate_pixel((sweep >> 5) & 31, sweep & 31);
+         sweep++;
+         });
+      uint8_t pixels[64][2];
+      for (int k = 0; k < 64; k++) {
+         pixels[k][0] = k / 32;
+         pixels[k][1] = k % 32;
+      }
+      bench.measure(prefix + ".estimate_pixels64", width, depth, 16, [&]() {
+         bench.sink = bench.sink + model.estimate_pixels(pixels, 64);
+         });
+   }
+}
+
+int main(int argc, char** argv) {
+   Bench bench;
+   for (int i = 1; i < argc; i++) {
+      if (!strcmp(argv[i], "--json")) bench.json = true;
+      else if (!strcmp(argv[i], "--csv")) bench.json = false;
+      else if (!strcmp(argv[i], "--filter") && i + 1 < argc) bench.filter = argv[++i];
+      else if (!strcmp(argv[i], "--min-time") && i + 1 < argc) bench.min_seconds = atof(argv[++i]);
+      else if (!strcmp(argv[i], "--workers") && i + 1 < argc) bench.workers_count = std::max(atoi(argv[++i]), 1);
+      else if (!strcmp(argv[i], "--mnist") && i + 1 < argc) bench.mnist_dir = argv[++i];
+      else {
+         fprintf(stderr, "usage: %s [--json|--csv] [--filter <substring>] [--min-time <seconds>] [--workers <count>] [--mnist <dir>]\n", argv[0]);
+         return 1;
+      }
+   }
+
+   std::unique_ptr<GateWorkerPool> workers;
+   if (bench.workers_count > 1) workers.reset(new GateWorkerPool(bench.workers_count));
+
+   check_kernels();
+#if INS_TELEMETRY
+   check_telemetry(workers.get());
+#endif
+   bench_allocations(workers.get());
+   bench_layers(bench, workers.get());
+   bench_mutation(bench);
+   bench_models(bench, workers.get());
+   bench_image_model<Models::SingleGateImage2DModel>(bench, "single", 1, 1);
+   bench_image_model<Models::HiddenLayerImage2DModel>(bench, "hidden", 4, 2);
+   check_static_training<Models::StaticSingleGateImage2DModel, Models::SingleGateImage2DModel>("single", 200000);
+   check_static_training<Models::StaticHiddenLayerImage2DModel, Models::HiddenLayerImage2DModel>("hidden", 200000);
+   bench_image_model<Models::StaticSingleGateImage2DModel>(bench, "static_single", 1, 1);
+   bench_image_model<Models::StaticHiddenLayerImage2DModel>(bench, "static_hidden", 4, 2);
+   bench_population(bench, workers.get());
+   bench_hogwild(bench);
+   bench_sparse(bench, workers.get());
+   bench_convolution(bench, workers.get());
+   bench_lookup(bench);
+   bench_codegen(bench);
+   bench_checkpoint(bench);
+   bench_mnist(bench);
+
+   bench.print();
+#if INS_TELEMETRY
+   GateTelemetry::write_json(stderr, GateTelemetry::instance().snapshot());
+#endif
+   return 0;
+}
@@ -0,0 +1,59 @@
+#include "../gates_unit/GateCodegen.h"
+#include "../gates_unit/GateCheckpoint.h"
+#include <stdio.h>
+#include <string.h>
+
+using namespace ins;
+
+// Export of a model checkpoint as a standalone C++ kernel:
+//    bitmesh-codegen <checkpoint> <name> <output-dir>     writes <output-dir>/<name>.h and <name>.cpp
+//    bitmesh-codegen --sample <checkpoint>                 trains and saves the sample model checked by the bench
+
+namespace {
+
+   // Pixel (i, j) of a 32x32 image read as 16 input gates, then 32 hidden gates and one output
+   const Shapes::DenseShape SampleShape = Shapes::DenseShape(3, 16, 1, 32, 1);
+
+   bool write_sample(const char* path) {
+      GateObjectModel model(SampleShape);
+      auto& inputs = *model.layers.front();
+      auto& outputs = *model.layers.back();
+      GateRandom random(1);
+      for (int k = 0; k < 1 << 16; k++) {
+         uint8_t i = random.next_u32() % 32, j = random.next_u32() % 32;
+         inputs.write_vec8(model.context, { i, j });
+         model.compute_forward();
+         bool expected = (-2 * int(i) - int(j)) < -40;
+         outputs.emit_feeback(model.context, { (outputs.get_state(model.context, 0) == expected) ? 1.0f : -1.0f });
+         model.compute_backward();
+      }
+      return GateCheckpoint::save(model, path);
+   }
+}
+
+int main(int argc, char** argv) {
+   if (argc == 3 && !strcmp(argv[1], "--sample")) {
+      if (write_sample(argv[2])) return 0;
+      fprintf(stderr, "cannot save sample model to '%s'\n", argv[2]);
+      return 1;
+   }
+   if (argc != 4) {
+      fprintf(stderr, "usage: %s <checkpoint> <name> <output-dir>\n       %s --sample <checkpoint>\n", argv[0], argv[0]);
+      return 1;
+   }
+
+   GateObjectModel model;
+   if (!GateCheckpoint::load(model, argv[1])) {
+      fprintf(stderr, "cannot load checkpoint '%s'\n", argv[1]);
+      return 1;
+   }
+   if (!GateCodegen::is_exportable(model)) {
+      fprintf(stderr, "model of '%s' has input layers past the first one\n", argv[1]);
+      return 1;
+   }
+   if (!GateCodegen::write_files(model, argv[3], argv[2])) {
+      fprintf(stderr, "cannot write '%s' sources to '%s'\n", argv[2], argv[3]);
+      return 1;
+   }
+   return 0;
+}
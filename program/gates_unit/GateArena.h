@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <memory_resource>
+
+namespace ins {
+
+   // Bump allocator over a single buffer, holding all the storage of a model
+   // Each allocation is a slab aligned on a cache line. Deallocation is a no-op, the whole buffer
+   // is freed at once with the arena. Requests past the buffer fall back to the upstream resource.
+   struct GateArena : std::pmr::memory_resource {
+      static constexpr size_t SlabAlign = 64;
+
+      std::pmr::memory_resource* upstream;
+      char* buffer = 0;
+      size_t capacity = 0;
+      size_t used = 0;
+      size_t spilled = 0; // bytes allocated upstream, when the capacity was underestimated
+
+      static constexpr size_t get_slab_size(size_t bytes) {
+         return (bytes + SlabAlign - 1) & ~(SlabAlign - 1);
+      }
+
+      explicit GateArena(size_t capacity = 0, std::pmr::memory_resource* upstream = std::pmr::new_delete_resource())
+         : upstream(upstream), capacity(get_slab_size(capacity)) {
+         if (this->capacity) buffer = (char*)upstream->allocate(this->capacity, SlabAlign);
+      }
+      ~GateArena() {
+         if (buffer) upstream->deallocate(buffer, capacity, SlabAlign);
+      }
+      GateArena(const GateArena&) = delete;
+      GateArena& operator=(const GateArena&) = delete;
+
+      bool contains(const void* p) const {
+         return (const char*)p >= buffer && (const char*)p < buffer + capacity;
+      }
+
+   protected:
+      void* do_allocate(size_t bytes, size_t alignment) override {
+         size_t size = get_slab_size(bytes);
+         if (alignment > SlabAlign || size > capacity - used) {
+            spilled += bytes;
+            return upstream->allocate(bytes, alignment);
+         }
+         void* p = buffer + used;
+         used += size;
+         return p;
+      }
+      void do_deallocate(void* p, size_t bytes, size_t alignment) override {
+         if (!contains(p)) upstream->deallocate(p, bytes, alignment);
+      }
+      bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+         return this == &other;
+      }
+   };
+}
@@ -0,0 +1,474 @@
+#pragma once
+
+#include "../mapped_file.h"
+#include "../thread_priority.h"
+#include "./GateObject.h"
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <stdio.h>
+#include <string>
+#include <thread>
+#include <type_traits>
+
+namespace ins {
+
+   // Versioned binary checkpoint of a GateObjectModel: topology, weights, mutation stats and random streams
+   // Sections are aligned on 64 bytes and hold the in-memory arrays as is, so that a mapped checkpoint
+   // is used in place (see MappedGateModel). Layout:
+   //    Header
+   //    LayerRecord[layers_count], in model layers order
+   //    ConnectionRecord[connections_count], in model connections order
+   //    per layer: GateObject::Gate[size]
+   //    per connection: weights, mut_prob_neg and mut_prob_pos arrays of width links per weights row,
+   //       then the source indices of the links when random (see GateLinks)
+   // Arrays are in host order, the endian tag and weight bits reject a checkpoint of another layout.
+   struct GateCheckpoint {
+      static constexpr uint32_t Version = 2;
+      static constexpr uint32_t EndianTag = 0x01020304;
+      static constexpr size_t Align = 64;
+
+      typedef GateObject::Gate Gate;
+      typedef GateObject::weight_t weight_t;
+      typedef GateObject::mut_prob_t mut_prob_t;
+      static_assert(std::is_trivially_copyable<Gate>::value, "gates are stored as raw bytes");
+      static_assert(sizeof(GateObject) == sizeof(Gate), "a layer is an array of gates");
+
+      struct Header {
+         char magic[8];
+         uint32_t version;
+         uint32_t endian_tag;
+         uint32_t weight_bits;
+         uint32_t layers_count;
+         uint32_t connections_count;
+         uint32_t reserved;
+         uint64_t file_size;
+         uint64_t layers_offset;
+         uint64_t connections_offset;
+         uint64_t random[4];         // model stream
+         uint64_t context_random[4]; // default context mutations stream
+      };
+      struct LayerRecord {
+         uint32_t size;
+         int32_t level;
+         uint64_t gates_offset;
+      };
+      struct ConnectionRecord {
+         uint32_t source; // index of the source layer
+         uint32_t target; // index of the target layer
+         uint32_t width;
+         uint32_t height;
+         GateLinks links;
+         uint32_t reserved;
+         uint64_t weights_offset;
+         uint64_t mut_prob_neg_offset;
+         uint64_t mut_prob_pos_offset;
+         uint64_t indices_offset;
+      };
+      static_assert(std::is_trivially_copyable<GateLinks>::value, "links are stored as raw bytes");
+
+      static constexpr uint64_t align(uint64_t offset) {
+         return (offset + Align - 1) & ~uint64_t(Align - 1);
+      }
+      static bool is_magic(const char* magic) {
+         return !memcmp(magic, "BITMESH", 8);
+      }
+
+      // Records of 'model' and its random streams, with the offsets of its arrays in the file
+      struct Layout {
+         Header header = {};
+         std::vector<LayerRecord> layers;
+         std::vector<ConnectionRecord> connections;
+
+         Layout(const GateObjectModel& model, const GateRandom& random, const GateRandom& context_random) {
+            memcpy(header.magic, "BITMESH", 8);
+            header.version = Version;
+            header.endian_tag = EndianTag;
+            header.weight_bits = INS_WEIGHT_BITS;
+            header.layers_count = uint32_t(model.layers.size());
+            header.connections_count = uint32_t(model.connections.size());
+            for (int k = 0; k < 4; k++) {
+               header.random[k] = random.s[k];
+               header.context_random[k] = context_random.s[k];
+            }
+
+            uint64_t offset = align(sizeof(Header));
+            header.layers_offset = offset;
+            offset = align(offset + model.layers.size() * sizeof(LayerRecord));
+            header.connections_offset = offset;
+            offset = align(offset + model.connections.size() * sizeof(ConnectionRecord));
+            for (auto* layer : model.layers) {
+               layers.push_back({ uint32_t(layer->size()), int32_t(layer->level), offset });
+               offset = align(offset + layer->size() * sizeof(Gate));
+            }
+            for (auto* connection : model.connections) {
+               uint64_t links_count = connection->weights.size();
+               ConnectionRecord record = {};
+               record.source = uint32_t(connection->source->index);
+               record.target = uint32_t(connection->target->index);
+               record.width = uint32_t(connection->width);
+               record.height = uint32_t(connection->height);
+               record.links = connection->links;
+               record.weights_offset = offset;
+               offset = align(offset + links_count * sizeof(weight_t));
+               record.mut_prob_neg_offset = offset;
+               offset = align(offset + links_count * sizeof(mut_prob_t));
+               record.mut_prob_pos_offset = offset;
+               offset = align(offset + links_count * sizeof(mut_prob_t));
+               record.indices_offset = offset;
+               offset = align(offset + connection->indices.size() * sizeof(uint32_t));
+               connections.push_back(record);
+            }
+            header.file_size = offset;
+         }
+      };
+
+      // Checks a mapped checkpoint header and records against the file size, returns null when invalid
+      static const Header* validate(const MappedFile& file) {
+         if (file.size < sizeof(Header)) return 0;
+         auto header = (const Header*)file.data;
+         if (!is_magic(header->magic) || header->version != Version || header->endian_tag != EndianTag) return 0;
+         if (header->weight_bits != INS_WEIGHT_BITS || header->file_size > file.size) return 0;
+         if (!has_array<LayerRecord>(file, header->layers_offset, header->layers_count)) return 0;
+         if (!has_array<ConnectionRecord>(file, header->connections_offset, header->connections_count)) return 0;
+
+         auto layers = (const LayerRecord*)(file.data + header->layers_offset);
+         for (uint32_t i = 0; i < header->layers_count; i++) {
+            if (!has_array<Gate>(file, layers[i].gates_offset, layers[i].size)) return 0;
+            if (i > 0 && layers[i].level < layers[i - 1].level) return 0;
+         }
+         auto connections = (const ConnectionRecord*)(file.data + header->connections_offset);
+         for (uint32_t c = 0; c < header->connections_count; c++) {
+            auto& record = connections[c];
+            if (record.source >= header->layers_count || record.target >= header->layers_count) return 0;
+            if (!record.links.is_valid(layers[record.source].size, record.height) || record.width != record.links.fan_in) return 0;
+            if (layers[record.target].size != record.height) return 0;
+            if (layers[record.source].level >= layers[record.target].level) return 0;
+            uint64_t links_count = uint64_t(record.width) * record.links.get_weights_rows_count(record.height);
+            if (!has_array<weight_t>(file, record.weights_offset, links_count)) return 0;
+            if (!has_array<mut_prob_t>(file, record.mut_prob_neg_offset, links_count)) return 0;
+            if (!has_array<mut_prob_t>(file, record.mut_prob_pos_offset, links_count)) return 0;
+            if (!has_array<uint32_t>(file, record.indices_offset, record.links.get_indices_count(record.height))) return 0;
+            if (!record.links.check_indices((const uint32_t*)(file.data + record.indices_offset), record.height)) return 0;
+         }
+         return header;
+      }
+
+      // Write 'model' to 'path', with its own random streams, which the calling thread shall own:
+      // saved between training steps, training resumes bit-identically (see load).
+      static bool save(const GateObjectModel& model, const std::string& path) {
+         return save(model, path, model.random, model.context.random);
+      }
+      // Write 'model' to 'path' with streams copied by the thread advancing them, eg. from a saver thread
+      // The file is written through a temporary one renamed once complete, so that a crash while saving
+      // leaves the previous checkpoint intact. Parameters are read relaxed, so training threads may keep
+      // updating them: the checkpoint then mixes updates as a Hogwild reader would, and resumes from
+      // these mixed parameters with the given streams.
+      static bool save(const GateObjectModel& model, const std::string& path, const GateRandom& random, const GateRandom& context_random) {
+         std::string temp_path = path + ".tmp";
+         FILE* file = fopen(temp_path.c_str(), "wb");
+         if (!file) return false;
+
+         Layout layout(model, random, context_random);
+         Writer writer{ file };
+         writer.write(&layout.header, sizeof(Header));
+         writer.pad();
+         writer.write(layout.layers.data(), layout.layers.size() * sizeof(LayerRecord));
+         writer.pad();
+         writer.write(layout.connections.data(), layout.connections.size() * sizeof(ConnectionRecord));
+         writer.pad();
+         for (auto* layer : model.layers) {
+            writer.write_gates(layer->data(), layer->size());
+            writer.pad();
+         }
+         for (auto* connection : model.connections) {
+            writer.write_relaxed(connection->weights.data(), connection->weights.size());
+            writer.pad();
+            writer.write_relaxed(connection->mut_prob_neg.data(), connection->mut_prob_neg.size());
+            writer.pad();
+            writer.write_relaxed(connection->mut_prob_pos.data(), connection->mut_prob_pos.size());
+            writer.pad();
+            writer.write(connection->indices.data(), connection->indices.size() * sizeof(uint32_t));
+            writer.pad();
+         }
+         bool ok = writer.ok && writer.offset == layout.header.file_size;
+         ok = (fclose(file) == 0) && ok;
+         if (ok) ok = replace_file(temp_path, path);
+         if (!ok) remove(temp_path.c_str());
+         return ok;
+      }
+
+      // Restore a checkpoint into 'model', which shall have no layer yet, or the checkpoint topology
+      // The model is ready to resume training: its random streams continue from the save.
+      static bool load(GateObjectModel& model, const std::string& path) {
+         MappedFile file(path.c_str());
+         auto header = validate(file);
+         if (!header) return false;
+
+         auto layers = (const LayerRecord*)(file.data + header->layers_offset);
+         auto connections = (const ConnectionRecord*)(file.data + header->connections_offset);
+         if (model.layers.empty()) {
+            model.layers.reserve(header->layers_count);
+            model.connections.reserve(header->connections_count);
+            for (uint32_t i = 0; i < header->layers_count; i++) {
+               model.add_layer(layers[i].size, layers[i].level);
+            }
+            for (uint32_t c = 0; c < header->connections_count; c++) {
+               model.connect_layer(model.layers[connections[c].source], model.layers[connections[c].target], connections[c].links);
+            }
+            model.sort_layers();
+         }
+         else if (!matches(model, layers, connections, *header)) {
+            return false;
+         }
+
+         for (uint32_t i = 0; i < header->layers_count; i++) {
+            memcpy((void*)model.layers[i]->data(), file.data + layers[i].gates_offset, layers[i].size * sizeof(Gate));
+         }
+         for (uint32_t c = 0; c < header->connections_count; c++) {
+            auto& record = connections[c];
+            auto connection = model.connections[c];
+            size_t links_count = connection->weights.size();
+            memcpy(connection->weights.data(), file.data + record.weights_offset, links_count * sizeof(weight_t));
+            memcpy(connection->mut_prob_neg.data(), file.data + record.mut_prob_neg_offset, links_count * sizeof(mut_prob_t));
+            memcpy(connection->mut_prob_pos.data(), file.data + record.mut_prob_pos_offset, links_count * sizeof(mut_prob_t));
+            if (!connection->indices.empty()) {
+               memcpy(connection->indices.data(), file.data + record.indices_offset, connection->indices.size() * sizeof(uint32_t));
+            }
+         }
+
+         GateRandom context_random;
+         for (int k = 0; k < 4; k++) {
+            model.random.s[k] = header->random[k];
+            context_random.s[k] = header->context_random[k];
+         }
+         model.initialize_context(model.context, context_random);
+         return true;
+      }
+
+   private:
+      // Whether 'count' values of T at 'offset' lie within the file, aligned for T
+      // Compared by division, so that a crafted offset or count cannot wrap the bound.
+      template <class T>
+      static bool has_array(const MappedFile& file, uint64_t offset, uint64_t count) {
+         return offset % alignof(T) == 0 && offset <= file.size && count <= (file.size - offset) / sizeof(T);
+      }
+      static bool matches(const GateObjectModel& model, const LayerRecord* layers, const ConnectionRecord* connections, const Header& header) {
+         if (model.layers.size() != header.layers_count || model.connections.size() != header.connections_count) return false;
+         for (uint32_t i = 0; i < header.layers_count; i++) {
+            if (model.layers[i]->size() != layers[i].size || model.layers[i]->level != layers[i].level) return false;
+         }
+         for (uint32_t c = 0; c < header.connections_count; c++) {
+            auto connection = model.connections[c];
+            if (connection->source->index != connections[c].source || connection->target->index != connections[c].target) return false;
+            if (connection->links != connections[c].links) return false;
+         }
+         return true;
+      }
+
+      struct Writer {
+         FILE* file;
+         uint64_t offset = 0;
+         bool ok = true;
+
+         void write(const void* data, size_t size) {
+            if (size && fwrite(data, 1, size, file) != size) ok = false;
+            offset += size;
+         }
+         void pad() {
+            static const char zeros[Align] = {};
+            this->write(zeros, size_t(align(offset) - offset));
+         }
+         template <class T>
+         void write_relaxed(const T* values, size_t count) {
+            T buffer[1024];
+            for (size_t i = 0; i < count; i += 1024) {
+               size_t n = std::min<size_t>(1024, count - i);
+               for (size_t k = 0; k < n; k++) buffer[k] = relaxed_load(values[i + k]);
+               this->write(buffer, n * sizeof(T));
+            }
+         }
+         void write_gates(const GateObject* gates, size_t count) {
+            Gate buffer[256];
+            for (size_t i = 0; i < count; i += 256) {
+               size_t n = std::min<size_t>(256, count - i);
+               memset((void*)buffer, 0, sizeof(buffer));
+               for (size_t k = 0; k < n; k++) {
+                  auto& gate = gates[i + k].gate;
+                  buffer[k].weight_base = relaxed_load(gate.weight_base);
+                  buffer[k].mut_prob_neg = relaxed_load(gate.mut_prob_neg);
+                  buffer[k].mut_prob_pos = relaxed_load(gate.mut_prob_pos);
+               }
+               this->write(buffer, n * sizeof(Gate));
+            }
+         }
+      };
+
+      static bool replace_file(const std::string& from, const std::string& to) {
+#if defined(_WIN32)
+         return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+         return rename(from.c_str(), to.c_str()) == 0;
+#endif
+      }
+   };
+
+   // Inference-only model served straight from a mapped checkpoint
+   // Opening only checks the records, weights are paged in by the OS as the forward reads them.
+   struct MappedGateModel {
+      MappedFile file;
+      const GateCheckpoint::Header* header = 0;
+      const GateCheckpoint::LayerRecord* layers = 0;
+      const GateCheckpoint::ConnectionRecord* connections = 0;
+      std::vector<std::vector<uint32_t>> inputs; // per layer, indexes of its input connections
+      std::vector<std::vector<uint64_t>> states; // per layer, bit-packed gate states
+
+      MappedGateModel() {
+      }
+      explicit MappedGateModel(const std::string& path) {
+         this->open(path);
+      }
+
+      bool is_open() const {
+         return this->header != 0;
+      }
+      bool open(const std::string& path) {
+         this->header = 0;
+         if (!file.open(path.c_str())) return false;
+         auto header = GateCheckpoint::validate(file);
+         if (!header) {
+            file.close();
+            return false;
+         }
+         this->layers = (const GateCheckpoint::LayerRecord*)(file.data + header->layers_offset);
+         this->connections = (const GateCheckpoint::ConnectionRecord*)(file.data + header->connections_offset);
+         this->inputs.assign(header->layers_count, {});
+         this->states.assign(header->layers_count, {});
+         for (uint32_t c = 0; c < header->connections_count; c++) {
+            this->inputs[this->connections[c].target].push_back(c);
+         }
+         for (uint32_t i = 0; i < header->layers_count; i++) {
+            this->states[i].assign((this->layers[i].size + 63) / 64, 0);
+         }
+         this->header = header;
+         return true;
+      }
+
+      size_t get_layers_count() const {
+         return this->header ? this->header->layers_count : 0;
+      }
+      size_t get_layer_size(size_t layer) const {
+         return this->layers[layer].size;
+      }
+      bool get_state(size_t layer, size_t index) const {
+         return (this->states[layer][index >> 6] >> (index & 63)) & 1;
+      }
+      // Write bit-packed states of a layer without input, eg. the first one
+      void write_states(size_t layer, const uint64_t* words) {
+         auto& layer_states = this->states[layer];
+         for (size_t w = 0; w < layer_states.size(); w++) {
+            layer_states[w] = words[w] & Kernels::word_mask(w, this->layers[layer].size);
+         }
+      }
+      void compute_forward() {
+         for (size_t l = 0; l < this->get_layers_count(); l++) {
+            if (this->inputs[l].empty()) continue;
+            auto gates = (const GateCheckpoint::Gate*)(file.data + this->layers[l].gates_offset);
+            auto& layer_states = this->states[l];
+            std::fill(layer_states.begin(), layer_states.end(), 0);
+            for (size_t i = 0; i < this->layers[l].size; i++) {
+               GateObject::weight_sum_t acc = gates[i].weight_base;
+               for (uint32_t c : this->inputs[l]) {
+                  auto& record = this->connections[c];
+                  auto weights = (const GateCheckpoint::weight_t*)(file.data + record.weights_offset);
+                  auto source = this->states[record.source].data();
+                  if (record.links.pattern == GateLinks::Dense) {
+                     acc += Kernels::masked_sum(weights + i * record.width, source, record.width);
+                  }
+                  else {
+                     auto indices = (const uint32_t*)(file.data + record.indices_offset);
+                     acc += record.links.masked_sums<Kernels::PlainSum>(weights + record.links.get_weights_row(i) * record.width, i, source, indices);
+                  }
+               }
+               layer_states[i >> 6] |= uint64_t(acc > 0) << (i & 63);
+            }
+         }
+      }
+   };
+
+   // Saves a training model periodically from a low priority thread
+   // Training threads never wait on it: the saver reads the live parameters relaxed, see GateCheckpoint::save.
+   // Random streams are plain state of the training thread, so the saver writes the last copies published
+   // by it (see publish_streams) instead of reading them while they advance.
+   struct GateCheckpointer {
+      const GateObjectModel& model;
+      std::string path;
+      std::chrono::milliseconds period;
+
+      std::mutex mutex; // guards stopping
+      std::mutex save_mutex; // serializes saves, which share the temporary file
+      std::mutex streams_mutex; // guards the published streams
+      GateRandom random;
+      GateRandom context_random;
+      std::condition_variable wakeup;
+      bool stopping = false;
+      std::atomic<size_t> saves_count;
+      std::atomic<size_t> failures_count;
+
+      std::thread thread;
+
+      // Constructed by the thread which trains the model, as it publishes the current streams
+      GateCheckpointer(const GateObjectModel& model, const std::string& path, double period_seconds)
+         : model(model), path(path), period(int64_t(period_seconds * 1000)), random(model.random), context_random(model.context.random),
+         saves_count(0), failures_count(0) {
+         thread = std::thread([this]() { this->save_main(); });
+      }
+      ~GateCheckpointer() {
+         {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+         }
+         wakeup.notify_all();
+         thread.join();
+      }
+      GateCheckpointer(const GateCheckpointer&) = delete;
+      GateCheckpointer& operator=(const GateCheckpointer&) = delete;
+
+      // Copy the model streams for the next periodic saves, from the training thread between steps
+      void publish_streams() {
+         std::lock_guard<std::mutex> lock(streams_mutex);
+         random = model.random;
+         context_random = model.context.random;
+      }
+      // Save now from the training thread, eg. at the end of an epoch, waiting for a periodic save in progress
+      bool save() {
+         this->publish_streams();
+         return this->save_published();
+      }
+
+   private:
+      bool save_published() {
+         std::lock_guard<std::mutex> lock(save_mutex);
+         GateRandom saved_random, saved_context_random;
+         {
+            std::lock_guard<std::mutex> lock(streams_mutex);
+            saved_random = random;
+            saved_context_random = context_random;
+         }
+         bool ok = GateCheckpoint::save(model, path, saved_random, saved_context_random);
+         if (ok) saves_count++;
+         else failures_count++;
+         return ok;
+      }
+      void save_main() {
+         lower_thread_priority();
+         for (;;) {
+            {
+               std::unique_lock<std::mutex> lock(mutex);
+               if (wakeup.wait_for(lock, period, [this]() { return stopping; })) return;
+            }
+            this->save_published();
+         }
+      }
+   };
+}
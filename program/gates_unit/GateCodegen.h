@@ -0,0 +1,140 @@
+#pragma once
+
+#include "./GateObject.h"
+#include <stdio.h>
+#include <string>
+
+namespace ins {
+
+   // Export of a trained model as a standalone C++ kernel, with weights baked in as constants
+   // The generated <name>.h/.cpp only need <stdint.h>, and define in namespace <name>:
+   //    forward(inputs, outputs):    bit-packed states of the first layer to bit-packed states of the last one
+   //    forward64(inputs, outputs):  bit-sliced form of 64 samples, sample k being bit k of the gate word
+   // Each gate is straight-line code: links of zero weight are dropped, the others are masked adds,
+   // so the kernel has no branch and no load besides its input states.
+   struct GateCodegen {
+
+      // The first layer must be the only one without input links, it is written by the caller
+      static bool is_exportable(const GateObjectModel& model) {
+         if (model.layers.size() < 2 || !model.layers[0]->inputs.empty()) return false;
+         for (size_t l = 1; l < model.layers.size(); l++) {
+            if (model.layers[l]->inputs.empty()) return false;
+         }
+         return true;
+      }
+
+      static bool write_files(const GateObjectModel& model, const std::string& dir, const std::string& name) {
+         if (!is_exportable(model)) return false;
+         return write_file(dir + "/" + name + ".h", [&](FILE* file) { write_header(model, file, name); })
+            && write_file(dir + "/" + name + ".cpp", [&](FILE* file) { write_source(model, file, name); });
+      }
+
+      static void write_header(const GateObjectModel& model, FILE* file, const std::string& name) {
+         fprintf(file, "// Generated by ins::GateCodegen, do not edit\n");
+         fprintf(file, "#pragma once\n\n#include <stdint.h>\n\n");
+         fprintf(file, "namespace %s {\n\n", name.c_str());
+         fprintf(file, "   static constexpr unsigned InputsCount = %zu;\n", model.layers.front()->size());
+         fprintf(file, "   static constexpr unsigned OutputsCount = %zu;\n\n", model.layers.back()->size());
+         fprintf(file, "   // inputs: (InputsCount + 63) / 64 words of bit-packed states, outputs: (OutputsCount + 63) / 64 words\n");
+         fprintf(file, "   void forward(const uint64_t* inputs, uint64_t* outputs);\n\n");
+         fprintf(file, "   // 64 samples at once: inputs[g] holds input g of sample k at bit k, outputs[o] likewise\n");
+         fprintf(file, "   void forward64(const uint64_t* inputs, uint64_t* outputs);\n");
+         fprintf(file, "}\n");
+      }
+
+      static void write_source(const GateObjectModel& model, FILE* file, const std::string& name) {
+         fprintf(file, "// Generated by ins::GateCodegen, do not edit\n");
+         fprintf(file, "#include \"%s.h\"\n\n", name.c_str());
+         fprintf(file, "namespace %s {\n\n", name.c_str());
+         fprintf(file, "   static inline int64_t take(const uint64_t* states, unsigned k, int64_t weight) {\n");
+         fprintf(file, "      return int64_t(0 - ((states[k >> 6] >> (k & 63)) & 1)) & weight;\n");
+         fprintf(file, "   }\n");
+         fprintf(file, "   static inline void fill(uint64_t* planes, int count, uint64_t value) {\n");
+         fprintf(file, "      for (int p = 0; p < count; p++) planes[p] = ((value >> p) & 1) ? ~uint64_t(0) : 0;\n");
+         fprintf(file, "   }\n");
+         fprintf(file, "   static inline void add(uint64_t* planes, int count, uint64_t value, uint64_t mask) {\n");
+         fprintf(file, "      uint64_t carry = 0;\n");
+         fprintf(file, "      for (int p = 0; p < count; p++) {\n");
+         fprintf(file, "         uint64_t a = planes[p], b = ((value >> p) & 1) ? mask : 0;\n");
+         fprintf(file, "         planes[p] = a ^ b ^ carry;\n");
+         fprintf(file, "         carry = (a & b) | (carry & (a ^ b));\n");
+         fprintf(file, "      }\n");
+         fprintf(file, "   }\n");
+         fprintf(file, "   static inline uint64_t greater(const uint64_t* a, const uint64_t* b, int count) {\n");
+         fprintf(file, "      uint64_t result = 0, equal = ~uint64_t(0);\n");
+         fprintf(file, "      for (int p = count - 1; p >= 0; p--) {\n");
+         fprintf(file, "         result |= equal & a[p] & ~b[p];\n");
+         fprintf(file, "         equal &= ~(a[p] ^ b[p]);\n");
+         fprintf(file, "      }\n");
+         fprintf(file, "      return result;\n");
+         fprintf(file, "   }\n\n");
+
+         size_t last = model.layers.size() - 1;
+
+         fprintf(file, "   void forward(const uint64_t* inputs, uint64_t* outputs) {\n");
+         fprintf(file, "      const uint64_t* s0 = inputs;\n");
+         for (size_t l = 1; l <= last; l++) {
+            auto layer = model.layers[l];
+            if (l < last) fprintf(file, "      uint64_t s%zu_[%zu] = {};\n      uint64_t* s%zu = s%zu_;\n", l, (layer->size() + 63) / 64, l, l);
+            else fprintf(file, "      uint64_t* s%zu = outputs;\n      for (unsigned w = 0; w < %zu; w++) s%zu[w] = 0;\n", l, (layer->size() + 63) / 64, l);
+            for (size_t i = 0; i < layer->size(); i++) {
+               fprintf(file, "      {\n         int64_t a = %lld;\n", (long long)relaxed_load((*layer)[i].gate.weight_base));
+               for (auto* input : layer->inputs) {
+                  for (size_t k = 0; k < input->width; k++) {
+                     auto weight = relaxed_load(input->get_row_weights(i)[k]);
+                     if (weight) fprintf(file, "         a += take(s%zu, %zu, %lld);\n", input->source->index, input->get_source(i, k), (long long)weight);
+                  }
+               }
+               fprintf(file, "         s%zu[%zu] |= uint64_t(a > 0) << %zu;\n      }\n", l, i >> 6, i & 63);
+            }
+         }
+         fprintf(file, "   }\n\n");
+
+         fprintf(file, "   void forward64(const uint64_t* inputs, uint64_t* outputs) {\n");
+         fprintf(file, "      const uint64_t* b0 = inputs;\n");
+         for (size_t l = 1; l <= last; l++) {
+            auto layer = model.layers[l];
+            if (l < last) fprintf(file, "      uint64_t b%zu[%zu];\n", l, layer->size());
+            else fprintf(file, "      uint64_t* b%zu = outputs;\n", l);
+            for (size_t i = 0; i < layer->size(); i++) {
+               // Positive and negative parts of the sum, on just enough planes for their exact bounds
+               int64_t weight_base = relaxed_load((*layer)[i].gate.weight_base);
+               uint64_t pos_max = weight_base > 0 ? uint64_t(weight_base) : 0;
+               uint64_t neg_max = weight_base < 0 ? uint64_t(-weight_base) : 0;
+               for (auto* input : layer->inputs) {
+                  for (size_t k = 0; k < input->width; k++) {
+                     int64_t weight = relaxed_load(input->get_row_weights(i)[k]);
+                     if (weight > 0) pos_max += uint64_t(weight);
+                     else neg_max += uint64_t(-weight);
+                  }
+               }
+               int planes_count = 1;
+               while (planes_count < 64 && (std::max(pos_max, neg_max) >> planes_count)) planes_count++;
+
+               fprintf(file, "      {\n         uint64_t p[%d], n[%d];\n", planes_count, planes_count);
+               fprintf(file, "         fill(p, %d, %lluu);\n", planes_count, (unsigned long long)(weight_base > 0 ? weight_base : 0));
+               fprintf(file, "         fill(n, %d, %lluu);\n", planes_count, (unsigned long long)(weight_base < 0 ? -weight_base : 0));
+               for (auto* input : layer->inputs) {
+                  for (size_t k = 0; k < input->width; k++) {
+                     int64_t weight = relaxed_load(input->get_row_weights(i)[k]);
+                     if (weight) fprintf(file, "         add(%s, %d, %lluu, b%zu[%zu]);\n", weight > 0 ? "p" : "n", planes_count, (unsigned long long)(weight > 0 ? weight : -weight), input->source->index, input->get_source(i, k));
+                  }
+               }
+               fprintf(file, "         b%zu[%zu] = greater(p, n, %d);\n      }\n", l, i, planes_count);
+            }
+         }
+         fprintf(file, "   }\n");
+         fprintf(file, "}\n");
+      }
+
+   private:
+      template <class Fn>
+      static bool write_file(const std::string& path, Fn write) {
+         FILE* file = fopen(path.c_str(), "w");
+         if (!file) return false;
+         write(file);
+         bool written = !ferror(file);
+         return (fclose(file) == 0) && written;
+      }
+   };
+}
@@ -0,0 +1,673 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define INS_KERNELS_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#else
+#define INS_KERNELS_X86 0
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define INS_TARGET(isa) __attribute__((target(isa)))
+#define INS_NOINLINE __attribute__((noinline))
+#else
+#define INS_TARGET(isa)
+#define INS_NOINLINE __declspec(noinline)
+#endif
+
+namespace ins {
+   namespace Kernels {
+
+      // Instruction sets with a dedicated kernel, ordered by preference
+      enum class Isa {
+         Scalar,
+         AVX2,
+         AVX512,
+      };
+
+      inline const char* isa_name(Isa isa) {
+         switch (isa) {
+         case Isa::AVX2: return "avx2";
+         case Isa::AVX512: return "avx512";
+         default: return "scalar";
+         }
+      }
+
+      inline int count_trailing_zeros(uint64_t x) {
+#if defined(_MSC_VER) && !defined(__clang__)
+         unsigned long index;
+         _BitScanForward64(&index, x);
+         return int(index);
+#else
+         return __builtin_ctzll(x);
+#endif
+      }
+
+      inline int count_bits(uint64_t x) {
+#if defined(_MSC_VER) && !defined(__clang__)
+         return int(__popcnt64(x));
+#else
+         return __builtin_popcountll(x);
+#endif
+      }
+
+      // Mask selecting the bits of word 'w' which are below 'count'
+      inline uint64_t word_mask(size_t w, size_t count) {
+         size_t remain = count - w * 64;
+         return remain >= 64 ? ~uint64_t(0) : ((uint64_t(1) << remain) - 1);
+      }
+
+      // Sums computed by a kernel: the weights sum, the absolute weights sum, or both in one pass,
+      // the absolute one then being written to *abs_sum
+      enum SumMode {
+         PlainSum,
+         AbsoluteSum,
+         BothSums,
+      };
+
+      //--- Scalar kernels: walk set bits only
+
+      template <SumMode mode, class weight_t>
+      inline int64_t masked_sum_scalar_impl(const weight_t* weights, const uint64_t* bits, size_t count, int64_t* abs_sum = 0) {
+         int64_t acc = 0, abs_acc = 0;
+         for (size_t w = 0; w * 64 < count; w++) {
+            uint64_t word = bits[w] & word_mask(w, count);
+            const weight_t* base = weights + w * 64;
+            while (word) {
+               int32_t weight = base[count_trailing_zeros(word)];
+               acc += weight;
+               abs_acc += abs(weight);
+               word &= word - 1;
+            }
+         }
+         if (mode == BothSums) *abs_sum = abs_acc;
+         return mode == AbsoluteSum ? abs_acc : acc;
+      }
+
+      inline int64_t masked_sum_i32_scalar(const int32_t* weights, const uint64_t* bits, size_t count) {
+         return masked_sum_scalar_impl<PlainSum>(weights, bits, count);
+      }
+      inline int64_t masked_abs_sum_i32_scalar(const int32_t* weights, const uint64_t* bits, size_t count) {
+         return masked_sum_scalar_impl<AbsoluteSum>(weights, bits, count);
+      }
+      inline int64_t masked_sums_i32_scalar(const int32_t* weights, const uint64_t* bits, size_t count, int64_t* abs_sum) {
+         return masked_sum_scalar_impl<BothSums>(weights, bits, count, abs_sum);
+      }
+      inline int64_t masked_sum_i16_scalar(const int16_t* weights, const uint64_t* bits, size_t count) {
+         return masked_sum_scalar_impl<PlainSum>(weights, bits, count);
+      }
+      inline int64_t masked_abs_sum_i16_scalar(const int16_t* weights, const uint64_t* bits, size_t count) {
+         return masked_sum_scalar_impl<AbsoluteSum>(weights, bits, count);
+      }
+      inline int64_t masked_sums_i16_scalar(const int16_t* weights, const uint64_t* bits, size_t count, int64_t* abs_sum) {
+         return masked_sum_scalar_impl<BothSums>(weights, bits, count, abs_sum);
+      }
+      inline int64_t masked_sum_i8_scalar(const int8_t* weights, const uint64_t* bits, size_t count) {
+         return masked_sum_scalar_impl<PlainSum>(weights, bits, count);
+      }
+      inline int64_t masked_abs_sum_i8_scalar(const int8_t* weights, const uint64_t* bits, size_t count) {
+         return masked_sum_scalar_impl<AbsoluteSum>(weights, bits, count);
+      }
+      inline int64_t masked_sums_i8_scalar(const int8_t* weights, const uint64_t* bits, size_t count, int64_t* abs_sum) {
+         return masked_sum_scalar_impl<BothSums>(weights, bits, count, abs_sum);
+      }
+
+#if INS_KERNELS_X86
+
+      //--- AVX2 kernels: expand 8 state bits into 8 lane masks per step
+
+      INS_TARGET("avx2") inline int64_t reduce_i64_avx2(__m256i acc) {
+         __m128i sum = _mm_add_epi64(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+         return _mm_cvtsi128_si64(sum) + _mm_extract_epi64(sum, 1);
+      }
+
+      template <SumMode mode>
+      INS_TARGET("avx2") inline int64_t masked_sum_i32_avx2_impl(const int32_t* weights, const uint64_t* bits, size_t count, int64_t* abs_sum = 0) {
+         const __m256i lane_bits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+         __m256i acc_lo = _mm256_setzero_si256(), acc_hi = _mm256_setzero_si256();
+         __m256i abs_lo = _mm256_setzero_si256(), abs_hi = _mm256_setzero_si256();
+         size_t i = 0;
+         for (; i + 8 <= count; i += 8) {
+            int byte = int((bits[i >> 6] >> (i & 63)) & 0xff);
+            if (!byte) continue;
+            __m256i mask = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(byte), lane_bits), lane_bits);
+            __m256i w = _mm256_loadu_si256((const __m256i*)(weights + i));
+            if (mode != AbsoluteSum) {
+               __m256i v = _mm256_and_si256(w, mask);
+               acc_lo = _mm256_add_epi64(acc_lo, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(v)));
+               acc_hi = _mm256_add_epi64(acc_hi, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(v, 1)));
+            }
+            if (mode != PlainSum) {
+               __m256i v = _mm256_and_si256(_mm256_abs_epi32(w), mask);
+               abs_lo = _mm256_add_epi64(abs_lo, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(v)));
+               abs_hi = _mm256_add_epi64(abs_hi, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(v, 1)));
+            }
+         }
+         int64_t acc = reduce_i64_avx2(_mm256_add_epi64(acc_lo, acc_hi));
+         int64_t abs_acc = reduce_i64_avx2(_mm256_add_epi64(abs_lo, abs_hi));
+         for (; i < count; i++) {
+            if ((bits[i >> 6] >> (i & 63)) & 1) {
+               acc += weights[i];
+               abs_acc += abs(weights[i]);
+            }
+         }
+         if (mode == BothSums) *abs_sum = abs_acc;
+         return mode == AbsoluteSum ? abs_acc : acc;
+      }
+
+      INS_TARGET("avx2") inline int64_t masked_sum_i32_avx2(const int32_t* weights, const uint64_t* bits, size_t count) {
+         return masked_sum_i32_avx2_impl<PlainSum>(weights, bits, count);
+      }
+      INS_TARGET("avx2") inline int64_t masked_abs_sum_i32_avx2(const int32_t* weights, const uint64_t* bits, size_t count) {
+         return masked_sum_i32_avx2_impl<AbsoluteSum>(weights, bits, count);
+      }
+      INS_TARGET("avx2") inline int64_t masked_sums_i32_avx2(const int32_t* weights, const uint64_t* bits, size_t count, int64_t* abs_sum) {
+         return masked_sum_i32_avx2_impl<BothSums>(weights, bits, count, abs_sum);
+      }
+
+      // Narrow kernels sum pairs into int32 lanes, flushed to int64 before the lanes total may overflow,
+      // so short rows reduce in int32 only
+      static constexpr size_t NarrowFlushSteps = 1024;
+
+      INS_TARGET("avx2") inline int64_t reduce_i32_avx2(__m256i acc) {
+         __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+         sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4e));
+         sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xb1));
+         return _mm_cvtsi128_si32(sum);
+      }
+
+      // 16 weights per step, 16 state bits expanded into 16 lane masks
+      template <SumMode mode>
+      INS_TARGET("avx2") inline int64_t masked_sum_i16_avx2_impl(const int16_t* weights, const uint64_t* bits, size_t count, int64_t* abs_sum = 0) {
+         const __m256i lane_bits = _mm256_setr_epi16(1, 2, 4, 8, 16, 32, 64, 128, 256, 512, 1024, 2048, 4096, 8192, 16384, -32768);
+         const __m256i ones = _mm256_set1_epi16(1);
+         int64_t sum = 0, abs_total = 0;
+         __m256i acc32 = _mm256_setzero_si256(), abs32 = _mm256_setzero_si256();
+         size_t i = 0, steps = 0;
+         for (; i + 16 <= count; i += 16) {
+            int word = int((bits[i >> 6] >> (i & 63)) & 0xffff);
+            if (!word) continue;
+            __m256i mask = _mm256_cmpeq_epi16(_mm256_and_si256(_mm256_set1_epi16(short(word)), lane_bits), lane_bits);
+            __m256i w = _mm256_loadu_si256((const __m256i*)(weights + i));
+            if (mode != AbsoluteSum) acc32 = _mm256_add_epi32(acc32, _mm256_madd_epi16(_mm256_and_si256(w, mask), ones));
+            if (mode != PlainSum) abs32 = _mm256_add_epi32(abs32, _mm256_madd_epi16(_mm256_and_si256(_mm256_abs_epi16(w), mask), ones));
+            if (++steps == NarrowFlushSteps) {
+               sum += reduce_i32_avx2(acc32);
+               abs_total += reduce_i32_avx2(abs32);
+               acc32 = abs32 = _mm256_setzero_si256();
+               steps = 0;
+            }
+         }
+         sum += reduce_i32_avx2(acc32);
+         abs_total += reduce_i32_avx2(abs32);
+         for (; i < count; i++) {
+            if ((bits[i >> 6] >> (i & 63)) & 1) {
+               sum += weights[i];
+               abs_total += abs(weights[i]);
+            }
+         }
+         if (mode == BothSums) *abs_sum = abs_total;
+         return mode == AbsoluteSum ? abs_total : sum;
+      }
+
+      // 32 weights per step, 32 state bits broadcast per byte then tested against their lane bit
+      template <SumMode mode>
+      INS_TARGET("avx2") inline int64_t masked_sum_i8_avx2_impl(const int8_t* weights, const uint64_t* bits, size_t count, int64_t* abs_sum = 0) {
+         const __m256i byte_select = _mm256_setr_epi8(
+            0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1,
+            2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3);
+         const __m256i lane_bits = _mm256_set1_epi64x(int64_t(0x8040201008040201ull));
+         const __m256i ones8 = _mm256_set1_epi8(1);
+         const __m256i ones16 = _mm256_set1_epi16(1);
+         int64_t sum = 0, abs_total = 0;
+         __m256i acc32 = _mm256_setzero_si256(), abs32 = _mm256_setzero_si256();
+         size_t i = 0, steps = 0;
+         for (; i + 32 <= count; i += 32) {
+            uint32_t word = uint32_t(bits[i >> 6] >> (i & 63));
+            if (!word) continue;
+            __m256i spread = _mm256_shuffle_epi8(_mm256_set1_epi32(int(word)), byte_select);
+            __m256i mask = _mm256_cmpeq_epi8(_mm256_and_si256(spread, lane_bits), lane_bits);
+            __m256i w = _mm256_loadu_si256((const __m256i*)(weights + i));
+            if (mode != AbsoluteSum) {
+               __m256i pairs = _mm256_maddubs_epi16(ones8, _mm256_and_si256(w, mask));
+               acc32 = _mm256_add_epi32(acc32, _mm256_madd_epi16(pairs, ones16));
+            }
+            if (mode != PlainSum) {
+               __m256i pairs = _mm256_maddubs_epi16(ones8, _mm256_and_si256(_mm256_abs_epi8(w), mask));
+               abs32 = _mm256_add_epi32(abs32, _mm256_madd_epi16(pairs, ones16));
+            }
+            if (++steps == NarrowFlushSteps) {
+               sum += reduce_i32_avx2(acc32);
+               abs_total += reduce_i32_avx2(abs32);
+               acc32 = abs32 = _mm256_setzero_si256();
+               steps = 0;
+            }
+         }
+         sum += reduce_i32_avx2(acc32);
+         abs_total += reduce_i32_avx2(abs32);
+         for (; i < count; i++) {
+            if ((bits[i >> 6] >> (i & 63)) & 1) {
+               sum += weights[i];
+               abs_total += abs(weights[i]);
+            }
+         }
+         if (mode == BothSums) *abs_sum = abs_total;
+         return mode == AbsoluteSum ? abs_total : sum;
+      }
+
+      INS_TARGET("avx2") inline int64_t masked_sum_i16_avx2(const int16_t* weights, const uint64_t* bits, size_t count) {
+         return masked_sum_i16_avx2_impl<PlainSum>(weights, bits, count);
+      }
+      INS_TARGET("avx2") inline int64_t masked_abs_sum_i16_avx2(const int16_t* weights, const uint64_t* bits, size_t count) {
+         return masked_sum_i16_avx2_impl<AbsoluteSum>(weights, bits, count);
+      }
+      INS_TARGET("avx2") inline int64_t masked_sums_i16_avx2(const int16_t* weights, const uint64_t* bits, size_t count, int64_t* abs_sum) {
+         return masked_sum_i16_avx2_impl<BothSums>(weights, bits, count, abs_sum);
+      }
+      INS_TARGET("avx2") inline int64_t masked_sum_i8_avx2(const int8_t* weights, const uint64_t* bits, size_t count) {
+         return masked_sum_i8_avx2_impl<PlainSum>(weights, bits, count);
+      }
+      INS_TARGET("avx2") inline int64_t masked_abs_sum_i8_avx2(const int8_t* weights, const uint64_t* bits, size_t count) {
+         return masked_sum_i8_avx2_impl<AbsoluteSum>(weights, bits, count);
+      }
+      INS_TARGET("avx2") inline int64_t masked_sums_i8_avx2(const int8_t* weights, const uint64_t* bits, size_t count, int64_t* abs_sum) {
+         return masked_sum_i8_avx2_impl<BothSums>(weights, bits, count, abs_sum);
+      }
+
+      //--- AVX-512 kernels: 16 state bits are directly a load mask
+
+      template <SumMode mode>
+      INS_TARGET("avx512f") inline int64_t masked_sum_i32_avx512_impl(const int32_t* weights, const uint64_t* bits, size_t count, int64_t* abs_sum = 0) {
+         __m512i acc_lo = _mm512_setzero_si512(), acc_hi = _mm512_setzero_si512();
+         __m512i abs_lo = _mm512_setzero_si512(), abs_hi = _mm512_setzero_si512();
+         for (size_t i = 0; i < count; i += 16) {
+            uint32_t mask = uint32_t(bits[i >> 6] >> (i & 63)) & 0xffff;
+            if (count - i < 16) mask &= (1u << (count - i)) - 1;
+            if (!mask) continue;
+            __m512i w = _mm512_maskz_loadu_epi32(__mmask16(mask), weights + i);
+            if (mode != AbsoluteSum) {
+               acc_lo = _mm512_add_epi64(acc_lo, _mm512_cvtepi32_epi64(_mm512_castsi512_si256(w)));
+               acc_hi = _mm512_add_epi64(acc_hi, _mm512_cvtepi32_epi64(_mm512_extracti64x4_epi64(w, 1)));
+            }
+            if (mode != PlainSum) {
+               __m512i v = _mm512_abs_epi32(w);
+               abs_lo = _mm512_add_epi64(abs_lo, _mm512_cvtepi32_epi64(_mm512_castsi512_si256(v)));
+               abs_hi = _mm512_add_epi64(abs_hi, _mm512_cvtepi32_epi64(_mm512_extracti64x4_epi64(v, 1)));
+            }
+         }
+         if (mode == BothSums) *abs_sum = _mm512_reduce_add_epi64(_mm512_add_epi64(abs_lo, abs_hi));
+         if (mode == AbsoluteSum) return _mm512_reduce_add_epi64(_mm512_add_epi64(abs_lo, abs_hi));
+         return _mm512_reduce_add_epi64(_mm512_add_epi64(acc_lo, acc_hi));
+      }
+
+      INS_TARGET("avx512f") inline int64_t masked_sum_i32_avx512(const int32_t* weights, const uint64_t* bits, size_t count) {
+         return masked_sum_i32_avx512_impl<PlainSum>(weights, bits, count);
+      }
+      INS_TARGET("avx512f") inline int64_t masked_abs_sum_i32_avx512(const int32_t* weights, const uint64_t* bits, size_t count) {
+         return masked_sum_i32_avx512_impl<AbsoluteSum>(weights, bits, count);
+      }
+      INS_TARGET("avx512f") inline int64_t masked_sums_i32_avx512(const int32_t* weights, const uint64_t* bits, size_t count, int64_t* abs_sum) {
+         return masked_sum_i32_avx512_impl<BothSums>(weights, bits, count, abs_sum);
+      }
+
+      //--- AVX-512BW narrow kernels: 32 or 64 state bits are directly a byte or word load mask
+
+      template <SumMode mode>
+      INS_TARGET("avx512f,avx512bw") inline int64_t masked_sum_i16_avx512_impl(const int16_t* weights, const uint64_t* bits, size_t count, int64_t* abs_sum = 0) {
+         const __m512i ones = _mm512_set1_epi16(1);
+         int64_t sum = 0, abs_total = 0;
+         __m512i acc32 = _mm512_setzero_si512(), abs32 = _mm512_setzero_si512();
+         size_t steps = 0;
+         for (size_t i = 0; i < count; i += 32) {
+            uint32_t mask = uint32_t(bits[i >> 6] >> (i & 63));
+            if (count - i < 32) mask &= (1u << (count - i)) - 1;
+            if (!mask) continue;
+            __m512i w = _mm512_maskz_loadu_epi16(__mmask32(mask), weights + i);
+            if (mode != AbsoluteSum) acc32 = _mm512_add_epi32(acc32, _mm512_madd_epi16(w, ones));
+            if (mode != PlainSum) abs32 = _mm512_add_epi32(abs32, _mm512_madd_epi16(_mm512_abs_epi16(w), ones));
+            if (++steps == NarrowFlushSteps) {
+               sum += _mm512_reduce_add_epi32(acc32);
+               abs_total += _mm512_reduce_add_epi32(abs32);
+               acc32 = abs32 = _mm512_setzero_si512();
+               steps = 0;
+            }
+         }
+         sum += _mm512_reduce_add_epi32(acc32);
+         abs_total += _mm512_reduce_add_epi32(abs32);
+         if (mode == BothSums) *abs_sum = abs_total;
+         return mode == AbsoluteSum ? abs_total : sum;
+      }
+
+      template <SumMode mode>
+      INS_TARGET("avx512f,avx512bw") inline int64_t masked_sum_i8_avx512_impl(const int8_t* weights, const uint64_t* bits, size_t count, int64_t* abs_sum = 0) {
+         const __m512i ones8 = _mm512_set1_epi8(1);
+         const __m512i ones16 = _mm512_set1_epi16(1);
+         int64_t sum = 0, abs_total = 0;
+         __m512i acc32 = _mm512_setzero_si512(), abs32 = _mm512_setzero_si512();
+         size_t steps = 0;
+         for (size_t i = 0; i < count; i += 64) {
+            uint64_t mask = bits[i >> 6] & word_mask(i >> 6, count);
+            if (!mask) continue;
+            __m512i w = _mm512_maskz_loadu_epi8(__mmask64(mask), weights + i);
+            if (mode != AbsoluteSum) acc32 = _mm512_add_epi32(acc32, _mm512_madd_epi16(_mm512_maddubs_epi16(ones8, w), ones16));
+            if (mode != PlainSum) abs32 = _mm512_add_epi32(abs32, _mm512_madd_epi16(_mm512_maddubs_epi16(ones8, _mm512_abs_epi8(w)), ones16));
+            if (++steps == NarrowFlushSteps) {
+               sum += _mm512_reduce_add_epi32(acc32);
+               abs_total += _mm512_reduce_add_epi32(abs32);
+               acc32 = abs32 = _mm512_setzero_si512();
+               steps = 0;
+            }
+         }
+         sum += _mm512_reduce_add_epi32(acc32);
+         abs_total += _mm512_reduce_add_epi32(abs32);
+         if (mode == BothSums) *abs_sum = abs_total;
+         return mode == AbsoluteSum ? abs_total : sum;
+      }
+
+      INS_TARGET("avx512f,avx512bw") inline int64_t masked_sum_i16_avx512(const int16_t* weights, const uint64_t* bits, size_t count) {
+         return masked_sum_i16_avx512_impl<PlainSum>(weights, bits, count);
+      }
+      INS_TARGET("avx512f,avx512bw") inline int64_t masked_abs_sum_i16_avx512(const int16_t* weights, const uint64_t* bits, size_t count) {
+         return masked_sum_i16_avx512_impl<AbsoluteSum>(weights, bits, count);
+      }
+      INS_TARGET("avx512f,avx512bw") inline int64_t masked_sums_i16_avx512(const int16_t* weights, const uint64_t* bits, size_t count, int64_t* abs_sum) {
+         return masked_sum_i16_avx512_impl<BothSums>(weights, bits, count, abs_sum);
+      }
+      INS_TARGET("avx512f,avx512bw") inline int64_t masked_sum_i8_avx512(const int8_t* weights, const uint64_t* bits, size_t count) {
+         return masked_sum_i8_avx512_impl<PlainSum>(weights, bits, count);
+      }
+      INS_TARGET("avx512f,avx512bw") inline int64_t masked_abs_sum_i8_avx512(const int8_t* weights, const uint64_t* bits, size_t count) {
+         return masked_sum_i8_avx512_impl<AbsoluteSum>(weights, bits, count);
+      }
+      INS_TARGET("avx512f,avx512bw") inline int64_t masked_sums_i8_avx512(const int8_t* weights, const uint64_t* bits, size_t count, int64_t* abs_sum) {
+         return masked_sum_i8_avx512_impl<BothSums>(weights, bits, count, abs_sum);
+      }
+
+      inline bool cpu_supports(Isa isa) {
+#if defined(__GNUC__) || defined(__clang__)
+         __builtin_cpu_init();
+         switch (isa) {
+         case Isa::AVX2: return __builtin_cpu_supports("avx2");
+         case Isa::AVX512: return __builtin_cpu_supports("avx512f");
+         default: return true;
+         }
+#elif defined(_MSC_VER)
+         int regs[4];
+         __cpuid(regs, 1);
+         bool osxsave = (regs[2] >> 27) & 1;
+         if (isa == Isa::Scalar) return true;
+         if (!osxsave) return false;
+         uint64_t xcr0 = _xgetbv(0);
+         __cpuidex(regs, 7, 0);
+         switch (isa) {
+         case Isa::AVX2: return ((xcr0 & 0x6) == 0x6) && ((regs[1] >> 5) & 1);
+         case Isa::AVX512: return ((xcr0 & 0xe6) == 0xe6) && ((regs[1] >> 16) & 1);
+         default: return false;
+         }
+#else
+         return isa == Isa::Scalar;
+#endif
+      }
+
+      // Byte and word AVX-512 instructions, used by the narrow weights kernels
+      inline bool cpu_supports_avx512bw() {
+         if (!cpu_supports(Isa::AVX512)) return false;
+#if defined(__GNUC__) || defined(__clang__)
+         return __builtin_cpu_supports("avx512bw");
+#elif defined(_MSC_VER)
+         int regs[4];
+         __cpuidex(regs, 7, 0);
+         return (regs[1] >> 30) & 1;
+#else
+         return false;
+#endif
+      }
+
+#else
+
+      inline bool cpu_supports(Isa isa) {
+         return isa == Isa::Scalar;
+      }
+      inline bool cpu_supports_avx512bw() {
+         return false;
+      }
+
+#endif
+
+      //--- Bit-sliced arithmetic: plane p holds bit p of 64 independent unsigned lane values
+
+      // Add 'value' to the lanes selected by 'mask'
+      inline void bitsliced_add(uint64_t* planes, int planes_count, uint64_t value, uint64_t mask) {
+         uint64_t carry = 0;
+         for (int p = 0; p < planes_count; p++) {
+            uint64_t b = ((value >> p) & 1) ? mask : 0;
+            if (!(b | carry)) {
+               if (!(value >> p)) break;
+               continue;
+            }
+            uint64_t a = planes[p];
+            planes[p] = a ^ b ^ carry;
+            carry = (a & b) | (carry & (a ^ b));
+         }
+      }
+
+      // Set 'value' in all lanes
+      inline void bitsliced_fill(uint64_t* planes, int planes_count, uint64_t value) {
+         for (int p = 0; p < planes_count; p++) {
+            planes[p] = ((value >> p) & 1) ? ~uint64_t(0) : 0;
+         }
+      }
+
+      // Lanes mask where a > b
+      inline uint64_t bitsliced_greater(const uint64_t* a, const uint64_t* b, int planes_count) {
+         uint64_t greater = 0;
+         uint64_t equal = ~uint64_t(0);
+         for (int p = planes_count - 1; p >= 0; p--) {
+            greater |= equal & a[p] & ~b[p];
+            equal &= ~(a[p] ^ b[p]);
+         }
+         return greater;
+      }
+
+      //--- Bit planes sums
+      // planes[2p] and planes[2p + 1] hold bit p of the positive and the negative weights magnitudes,
+      // one bit per link: the weights sum of the active links is then popcounts of the planes ANDed with 'bits'.
+
+      inline int64_t planes_sums_scalar(const uint64_t* planes, size_t planes_count, uint64_t bits, int64_t* abs_sum) {
+         int64_t pos_sum = 0, neg_sum = 0;
+         for (size_t p = 0; p < planes_count; p++) {
+            pos_sum += int64_t(count_bits(planes[2 * p] & bits)) << p;
+            neg_sum += int64_t(count_bits(planes[2 * p + 1] & bits)) << p;
+         }
+         *abs_sum = pos_sum + neg_sum;
+         return pos_sum - neg_sum;
+      }
+#if INS_KERNELS_X86
+      // Same, with the popcnt instruction which x86 builds without -march do not assume
+      INS_TARGET("popcnt") inline int64_t planes_sums_popcnt(const uint64_t* planes, size_t planes_count, uint64_t bits, int64_t* abs_sum) {
+         int64_t pos_sum = 0, neg_sum = 0;
+         for (size_t p = 0; p < planes_count; p++) {
+            pos_sum += int64_t(_mm_popcnt_u64(planes[2 * p] & bits)) << p;
+            neg_sum += int64_t(_mm_popcnt_u64(planes[2 * p + 1] & bits)) << p;
+         }
+         *abs_sum = pos_sum + neg_sum;
+         return pos_sum - neg_sum;
+      }
+#endif
+
+      //--- Binarization
+
+      // Set bit i of 'words' when values[i] > threshold, for i < count, and clear the bits past count
+      inline void threshold_bits(const uint8_t* values, size_t count, uint8_t threshold, uint64_t* words) {
+         size_t i = 0;
+#if defined(__SSE2__) || defined(_M_X64)
+         // Unsigned compare as signed, once both sides are offset by 128
+         const __m128i offset = _mm_set1_epi8(char(0x80));
+         const __m128i limit = _mm_set1_epi8(char(threshold ^ 0x80));
+         for (; i + 64 <= count; i += 64) {
+            uint64_t word = 0;
+            for (int k = 0; k < 4; k++) {
+               __m128i v = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(values + i + k * 16)), offset);
+               word |= uint64_t(uint32_t(_mm_movemask_epi8(_mm_cmpgt_epi8(v, limit)))) << (k * 16);
+            }
+            words[i >> 6] = word;
+         }
+#endif
+         for (; i < count; i += 64) {
+            uint64_t word = 0;
+            for (size_t b = 0; b < 64 && i + b < count; b++) {
+               word |= uint64_t(values[i + b] > threshold) << b;
+            }
+            words[i >> 6] = word;
+         }
+      }
+
+      typedef int64_t(*masked_sum_i32_t)(const int32_t* weights, const uint64_t* bits, size_t count);
+      typedef int64_t(*masked_sum_i16_t)(const int16_t* weights, const uint64_t* bits, size_t count);
+      typedef int64_t(*masked_sum_i8_t)(const int8_t* weights, const uint64_t* bits, size_t count);
+      typedef int64_t(*masked_sums_i32_t)(const int32_t* weights, const uint64_t* bits, size_t count, int64_t* abs_sum);
+      typedef int64_t(*masked_sums_i16_t)(const int16_t* weights, const uint64_t* bits, size_t count, int64_t* abs_sum);
+      typedef int64_t(*masked_sums_i8_t)(const int8_t* weights, const uint64_t* bits, size_t count, int64_t* abs_sum);
+      typedef int64_t(*planes_sums_t)(const uint64_t* planes, size_t planes_count, uint64_t bits, int64_t* abs_sum);
+
+      // Kernel table selected at runtime from the host CPU features
+      struct Dispatch {
+         Isa isa = Isa::Scalar;
+         masked_sum_i32_t masked_sum_i32 = masked_sum_i32_scalar;
+         masked_sum_i32_t masked_abs_sum_i32 = masked_abs_sum_i32_scalar;
+         masked_sum_i16_t masked_sum_i16 = masked_sum_i16_scalar;
+         masked_sum_i16_t masked_abs_sum_i16 = masked_abs_sum_i16_scalar;
+         masked_sum_i8_t masked_sum_i8 = masked_sum_i8_scalar;
+         masked_sum_i8_t masked_abs_sum_i8 = masked_abs_sum_i8_scalar;
+         masked_sums_i32_t masked_sums_i32 = masked_sums_i32_scalar;
+         masked_sums_i16_t masked_sums_i16 = masked_sums_i16_scalar;
+         masked_sums_i8_t masked_sums_i8 = masked_sums_i8_scalar;
+         planes_sums_t planes_sums = planes_sums_scalar;
+
+         // Select the kernels of 'isa', falling back to scalar when unsupported
+         bool use(Isa isa) {
+            if (!cpu_supports(isa)) return false;
+            this->isa = isa;
+            switch (isa) {
+#if INS_KERNELS_X86
+            case Isa::AVX512:
+               this->masked_sum_i32 = masked_sum_i32_avx512;
+               this->masked_abs_sum_i32 = masked_abs_sum_i32_avx512;
+               this->masked_sums_i32 = masked_sums_i32_avx512;
+               this->planes_sums = planes_sums_popcnt;
+               if (cpu_supports_avx512bw()) {
+                  this->masked_sum_i16 = masked_sum_i16_avx512;
+                  this->masked_abs_sum_i16 = masked_abs_sum_i16_avx512;
+                  this->masked_sums_i16 = masked_sums_i16_avx512;
+                  this->masked_sum_i8 = masked_sum_i8_avx512;
+                  this->masked_abs_sum_i8 = masked_abs_sum_i8_avx512;
+                  this->masked_sums_i8 = masked_sums_i8_avx512;
+               }
+               else {
+                  this->masked_sum_i16 = masked_sum_i16_avx2;
+                  this->masked_abs_sum_i16 = masked_abs_sum_i16_avx2;
+                  this->masked_sums_i16 = masked_sums_i16_avx2;
+                  this->masked_sum_i8 = masked_sum_i8_avx2;
+                  this->masked_abs_sum_i8 = masked_abs_sum_i8_avx2;
+                  this->masked_sums_i8 = masked_sums_i8_avx2;
+               }
+               break;
+            case Isa::AVX2:
+               this->masked_sum_i32 = masked_sum_i32_avx2;
+               this->masked_abs_sum_i32 = masked_abs_sum_i32_avx2;
+               this->masked_sums_i32 = masked_sums_i32_avx2;
+               this->planes_sums = planes_sums_popcnt;
+               this->masked_sum_i16 = masked_sum_i16_avx2;
+               this->masked_abs_sum_i16 = masked_abs_sum_i16_avx2;
+               this->masked_sums_i16 = masked_sums_i16_avx2;
+               this->masked_sum_i8 = masked_sum_i8_avx2;
+               this->masked_abs_sum_i8 = masked_abs_sum_i8_avx2;
+               this->masked_sums_i8 = masked_sums_i8_avx2;
+               break;
+#endif
+            default:
+               this->isa = Isa::Scalar;
+               this->masked_sum_i32 = masked_sum_i32_scalar;
+               this->masked_abs_sum_i32 = masked_abs_sum_i32_scalar;
+               this->masked_sums_i32 = masked_sums_i32_scalar;
+               this->planes_sums = planes_sums_scalar;
+               this->masked_sum_i16 = masked_sum_i16_scalar;
+               this->masked_abs_sum_i16 = masked_abs_sum_i16_scalar;
+               this->masked_sums_i16 = masked_sums_i16_scalar;
+               this->masked_sum_i8 = masked_sum_i8_scalar;
+               this->masked_abs_sum_i8 = masked_abs_sum_i8_scalar;
+               this->masked_sums_i8 = masked_sums_i8_scalar;
+               break;
+            }
+            return true;
+         }
+         static Dispatch detect() {
+            Dispatch dispatch;
+            const char* forced = getenv("BITMESH_ISA");
+            if (forced) {
+               if (!strcmp(forced, "avx512") && dispatch.use(Isa::AVX512)) return dispatch;
+               if (!strcmp(forced, "avx2") && dispatch.use(Isa::AVX2)) return dispatch;
+               dispatch.use(Isa::Scalar);
+               return dispatch;
+            }
+            if (!dispatch.use(Isa::AVX512) && !dispatch.use(Isa::AVX2)) {
+               dispatch.use(Isa::Scalar);
+            }
+            return dispatch;
+         }
+      };
+
+      inline Dispatch& dispatch() {
+         static Dispatch instance = Dispatch::detect();
+         return instance;
+      }
+
+      // Sum of weights[i] for each i < count where bit i of 'bits' is set
+      inline int64_t masked_sum(const int32_t* weights, const uint64_t* bits, size_t count) {
+         return dispatch().masked_sum_i32(weights, bits, count);
+      }
+
+      // Sum of abs(weights[i]) for each i < count where bit i of 'bits' is set
+      inline int64_t masked_abs_sum(const int32_t* weights, const uint64_t* bits, size_t count) {
+         return dispatch().masked_abs_sum_i32(weights, bits, count);
+      }
+
+      // Narrow weights variants, for INS_WEIGHT_BITS 16 and 8
+      inline int64_t masked_sum(const int16_t* weights, const uint64_t* bits, size_t count) {
+         return dispatch().masked_sum_i16(weights, bits, count);
+      }
+      inline int64_t masked_abs_sum(const int16_t* weights, const uint64_t* bits, size_t count) {
+         return dispatch().masked_abs_sum_i16(weights, bits, count);
+      }
+      inline int64_t masked_sum(const int8_t* weights, const uint64_t* bits, size_t count) {
+         return dispatch().masked_sum_i8(weights, bits, count);
+      }
+      inline int64_t masked_abs_sum(const int8_t* weights, const uint64_t* bits, size_t count) {
+         return dispatch().masked_abs_sum_i8(weights, bits, count);
+      }
+
+      // Both sums in one pass over the weights: returns the weights sum, and sets 'abs_sum' to the absolute one
+      inline int64_t masked_sums(const int32_t* weights, const uint64_t* bits, size_t count, int64_t& abs_sum) {
+         return dispatch().masked_sums_i32(weights, bits, count, &abs_sum);
+      }
+      inline int64_t masked_sums(const int16_t* weights, const uint64_t* bits, size_t count, int64_t& abs_sum) {
+         return dispatch().masked_sums_i16(weights, bits, count, &abs_sum);
+      }
+      inline int64_t masked_sums(const int8_t* weights, const uint64_t* bits, size_t count, int64_t& abs_sum) {
+         return dispatch().masked_sums_i8(weights, bits, count, &abs_sum);
+      }
+
+      // Weights sum of the links set in 'bits' from their bit planes, and the absolute one to 'abs_sum'
+      inline int64_t planes_sums(const uint64_t* planes, size_t planes_count, uint64_t bits, int64_t& abs_sum) {
+         return dispatch().planes_sums(planes, planes_count, bits, &abs_sum);
+      }
+   }
+}
@@ -0,0 +1,280 @@
+#pragma once
+
+#include "../math.h"
+#include "./GateKernels.h"
+#include "./GateRandom.h"
+#include <algorithm>
+#include <stdint.h>
+#include <stddef.h>
+
+namespace ins {
+
+   // Topology of the links from a source layer to a target layer
+   // Links of target gate i are numbered k in [0, fan_in), row-major as the weights:
+   //    Dense:  link k reads source gate k
+   //    Random: link k reads indices[i * fan_in + k], fan_in sorted distinct gates drawn per row
+   //    Local:  the source is a rows x cols image, target gate i reads the window x window patch of
+   //            position i % positions, windows stepping by stride; link k is patch pixel (k / window, k % window).
+   //            Several maps of positions may follow each other in the target layer, each with its own weights.
+   //    Skip:   a single link, target gate i reads source gate i % source_size
+   //    Convolution: links as Local, but the gates of a map share one kernel of weights and stats,
+   //            so weights rows are maps instead of target gates
+   // Only Random stores indices: other patterns derive the source gate of a link from the geometry.
+   // The record is plain data, and is stored as is in checkpoints.
+   struct GateLinks {
+      enum Pattern : uint32_t {
+         Dense,
+         Random,
+         Local,
+         Skip,
+         Convolution,
+      };
+
+      uint32_t pattern = Dense;
+      uint32_t source_size = 0;
+      uint32_t fan_in = 0; // links per target gate
+      uint32_t rows = 0; // Local and Convolution: source image rows and columns
+      uint32_t cols = 0;
+      uint32_t window = 0; // Local and Convolution: window side, and step between windows
+      uint32_t stride = 0;
+
+      static GateLinks dense(size_t source_size) {
+         GateLinks links;
+         links.source_size = uint32_t(source_size);
+         links.fan_in = uint32_t(source_size);
+         return links;
+      }
+      static GateLinks random(size_t source_size, size_t fan_in) {
+         GateLinks links;
+         links.pattern = Random;
+         links.source_size = uint32_t(source_size);
+         links.fan_in = uint32_t(fan_in);
+         return links;
+      }
+      static GateLinks local(size_t rows, size_t cols, size_t window, size_t stride = 1) {
+         GateLinks links;
+         links.pattern = Local;
+         links.source_size = uint32_t(rows * cols);
+         links.fan_in = uint32_t(window * window);
+         links.rows = uint32_t(rows);
+         links.cols = uint32_t(cols);
+         links.window = uint32_t(window);
+         links.stride = uint32_t(stride);
+         return links;
+      }
+      static GateLinks convolution(size_t rows, size_t cols, size_t window, size_t stride = 1) {
+         GateLinks links = local(rows, cols, window, stride);
+         links.pattern = Convolution;
+         return links;
+      }
+      static GateLinks skip(size_t source_size) {
+         GateLinks links;
+         links.pattern = Skip;
+         links.source_size = uint32_t(source_size);
+         links.fan_in = 1;
+         return links;
+      }
+
+      bool operator==(const GateLinks& other) const {
+         return pattern == other.pattern && source_size == other.source_size && fan_in == other.fan_in
+            && rows == other.rows && cols == other.cols && window == other.window && stride == other.stride;
+      }
+      bool operator!=(const GateLinks& other) const {
+         return !(*this == other);
+      }
+
+      size_t get_out_rows() const {
+         return (rows - window) / stride + 1;
+      }
+      size_t get_out_cols() const {
+         return (cols - window) / stride + 1;
+      }
+      size_t get_positions_count() const {
+         return get_out_rows() * get_out_cols();
+      }
+      size_t get_indices_count(size_t target_size) const {
+         return pattern == Random ? target_size * fan_in : 0;
+      }
+      bool is_shared() const {
+         return pattern == Convolution;
+      }
+      // Rows of weights, ie. target gates unless shared
+      size_t get_weights_rows_count(size_t target_size) const {
+         return this->is_shared() ? target_size / this->get_positions_count() : target_size;
+      }
+      // Weights row of target gate 'row', its map when shared
+      size_t get_weights_row(size_t row) const {
+         return this->is_shared() ? row / this->get_positions_count() : row;
+      }
+      // Whether the links fit source and target layers of these sizes
+      bool is_valid(size_t source, size_t target) const {
+         if (source != source_size || target == 0) return false;
+         switch (pattern) {
+         case Dense: return fan_in == source_size;
+         case Random: return fan_in > 0 && fan_in <= source_size;
+         case Local:
+         case Convolution:
+            if (rows == 0 || cols == 0 || window == 0 || stride == 0 || window > rows || window > cols) return false;
+            return size_t(rows) * cols == source_size && fan_in == window * window && target % this->get_positions_count() == 0;
+         case Skip: return source_size > 0 && fan_in == 1;
+         default: return false;
+         }
+      }
+      // Whether a source gate maps back to its links without a search, see for_each_link
+      bool has_columns() const {
+         return pattern != Random;
+      }
+
+      // Draw the sorted source gates of each row of a Random pattern, with Floyd's sampling, other patterns draw nothing
+      void draw_indices(uint32_t* indices, size_t target_size, GateRandom& random) const {
+         if (pattern != Random) return;
+         for (size_t i = 0; i < target_size; i++) {
+            uint32_t* row = indices + i * fan_in;
+            for (uint32_t n = source_size - fan_in, count = 0; n < source_size; n++, count++) {
+               uint32_t value = uint32_t(random.next() % (uint64_t(n) + 1));
+               if (std::find(row, row + count, value) != row + count) value = n;
+               row[count] = value;
+            }
+            std::sort(row, row + fan_in);
+         }
+      }
+      // Whether drawn indices are sorted distinct source gates, eg. read from a file
+      bool check_indices(const uint32_t* indices, size_t target_size) const {
+         if (pattern != Random) return true;
+         for (size_t i = 0; i < target_size * fan_in; i++) {
+            if (indices[i] >= source_size) return false;
+            if (i % fan_in && indices[i] <= indices[i - 1]) return false;
+         }
+         return true;
+      }
+
+      // Source gate of link k of target gate 'row'
+      size_t get_source(size_t row, size_t k, const uint32_t* indices) const {
+         switch (pattern) {
+         case Random: return indices[row * fan_in + k];
+         case Local:
+         case Convolution: return this->get_origin(row) + (k / window) * cols + k % window;
+         case Skip: return row % source_size;
+         default: return k;
+         }
+      }
+      // States of links [k, k + count) of target gate 'row', link k + j at bit j, with count <= 64
+      uint64_t gather(size_t row, size_t k, size_t count, const uint64_t* states, const uint32_t* indices) const {
+         switch (pattern) {
+         case Random: {
+            const uint32_t* row_indices = indices + row * fan_in + k;
+            uint64_t bits = 0;
+            for (size_t j = 0; j < count; j++) {
+               uint32_t index = row_indices[j];
+               bits |= ((states[index >> 6] >> (index & 63)) & 1) << j;
+            }
+            return bits;
+         }
+         case Local:
+         case Convolution: {
+            // Copy the patch row by row, each row being a run of contiguous source bits
+            size_t origin = this->get_origin(row);
+            size_t dy = k / window, dx = k % window;
+            uint64_t bits = 0;
+            for (size_t j = 0; j < count; dy++, dx = 0) {
+               size_t run = std::min<size_t>(window - dx, count - j);
+               bits |= extract_bits(states, origin + dy * cols + dx, run) << j;
+               j += run;
+            }
+            return bits;
+         }
+         case Skip: {
+            size_t index = row % source_size;
+            return (states[index >> 6] >> (index & 63)) & 1;
+         }
+         default:
+            return extract_bits(states, k, count);
+         }
+      }
+      // States of the whole window of each position of a Local or Convolution pattern to patches[position],
+      // as gather would for any row of that position, with fan_in <= 64
+      void gather_patches(const uint64_t* states, uint64_t* patches) const {
+         size_t out_rows = this->get_out_rows(), out_cols = this->get_out_cols();
+         for (size_t oy = 0; oy < out_rows; oy++) {
+            for (size_t ox = 0; ox < out_cols; ox++) {
+               size_t origin = oy * stride * cols + ox * stride;
+               uint64_t bits = 0;
+               for (size_t dy = 0; dy < window; dy++) {
+                  bits |= extract_bits(states, origin + dy * cols, window) << (dy * window);
+               }
+               patches[oy * out_cols + ox] = bits;
+            }
+         }
+      }
+      // Sums of the link weights of target gate 'row' whose source is active, see Kernels::SumMode
+      // Link states are gathered by 64, then summed as a dense row.
+      template <Kernels::SumMode mode, class weight_t>
+      int64_t masked_sums(const weight_t* row_weights, size_t row, const uint64_t* states, const uint32_t* indices, int64_t* abs_sum = 0) const {
+         if (pattern == Skip) {
+            int64_t weight = this->gather(row, 0, 1, states, indices) ? int64_t(relaxed_load(row_weights[0])) : 0;
+            if (mode == Kernels::BothSums) *abs_sum = weight < 0 ? -weight : weight;
+            return mode == Kernels::AbsoluteSum ? (weight < 0 ? -weight : weight) : weight;
+         }
+         int64_t sum = 0, abs_total = 0;
+         for (size_t k = 0; k < fan_in; k += 64) {
+            size_t count = std::min<size_t>(64, fan_in - k);
+            uint64_t bits = this->gather(row, k, count, states, indices);
+            if (mode == Kernels::PlainSum) sum += Kernels::masked_sum(row_weights + k, &bits, count);
+            else if (mode == Kernels::AbsoluteSum) abs_total += Kernels::masked_abs_sum(row_weights + k, &bits, count);
+            else {
+               int64_t block_abs_sum;
+               sum += Kernels::masked_sums(row_weights + k, &bits, count, block_abs_sum);
+               abs_total += block_abs_sum;
+            }
+         }
+         if (mode == Kernels::BothSums) *abs_sum = abs_total;
+         return mode == Kernels::AbsoluteSum ? abs_total : sum;
+      }
+      // Call fn(row, k) for each link k of a target gate 'row' reading source gate 'index',
+      // for patterns which have columns
+      template <class Fn>
+      void for_each_link(size_t index, size_t target_size, Fn fn) const {
+         switch (pattern) {
+         case Dense:
+            for (size_t i = 0; i < target_size; i++) fn(i, index);
+            break;
+         case Local:
+         case Convolution: {
+            // Windows covering pixel (y, x), then the same position in each map
+            size_t y = index / cols, x = index % cols;
+            size_t out_rows = this->get_out_rows(), out_cols = this->get_out_cols(), positions = out_rows * out_cols;
+            size_t oy_begin = y + 1 > window ? (y + 1 - window + stride - 1) / stride : 0;
+            size_t ox_begin = x + 1 > window ? (x + 1 - window + stride - 1) / stride : 0;
+            size_t oy_end = std::min(y / stride + 1, out_rows);
+            size_t ox_end = std::min(x / stride + 1, out_cols);
+            for (size_t oy = oy_begin; oy < oy_end; oy++) {
+               for (size_t ox = ox_begin; ox < ox_end; ox++) {
+                  size_t k = (y - oy * stride) * window + (x - ox * stride);
+                  for (size_t p = oy * out_cols + ox; p < target_size; p += positions) fn(p, k);
+               }
+            }
+            break;
+         }
+         case Skip:
+            for (size_t i = index; i < target_size; i += source_size) fn(i, 0);
+            break;
+         default:
+            break;
+         }
+      }
+
+      // Source gate of the first link of a Local or Convolution row
+      size_t get_origin(size_t row) const {
+         size_t out_cols = this->get_out_cols();
+         size_t position = row % (this->get_out_rows() * out_cols);
+         return (position / out_cols) * stride * cols + (position % out_cols) * stride;
+      }
+      // Bits [position, position + count) of bit-packed states, with count <= 64
+      static uint64_t extract_bits(const uint64_t* states, size_t position, size_t count) {
+         size_t w = position >> 6, shift = position & 63;
+         uint64_t bits = states[w] >> shift;
+         if (shift + count > 64) bits |= states[w + 1] << (64 - shift);
+         return count < 64 ? bits & ((uint64_t(1) << count) - 1) : bits;
+      }
+   };
+}
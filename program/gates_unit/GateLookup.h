@@ -0,0 +1,157 @@
+#pragma once
+
+#include "./GateObject.h"
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+namespace ins {
+
+   // Frozen copy of a GateObjectModel, for inference only
+   // Each input byte of a gate contributes one of 256 partial sums, so a link is precomputed into
+   // tables[byte][value][gate]: the forward adds one table row per source byte, instead of summing
+   // every link. Inputs whose tables exceed MaxTableBytes keep their frozen weights and masked sums,
+   // as do sparse inputs, whose links do not cover whole source bytes.
+   struct GateLookupModel {
+      typedef GateObject::weight_t weight_t;
+      typedef GateObject::weight_sum_t weight_sum_t;
+      typedef int32_t table_t;
+
+      static constexpr size_t MaxTableBytes = size_t(1) << 20;
+
+      struct Input {
+         size_t source; // index of the source layer
+         size_t width;
+         size_t bytes_count;
+         std::vector<table_t> tables; // [byte][value][gate], empty when not using lookup
+         std::vector<weight_t> weights; // [gate][link], when not using lookup
+         GateLinks links;
+         std::vector<uint32_t> indices; // source gates of random links
+      };
+      struct Layer {
+         size_t size = 0;
+         std::vector<uint64_t> states;
+         std::vector<weight_sum_t> bases;
+         std::vector<weight_sum_t> accumulators;
+         std::vector<Input> inputs;
+      };
+
+      std::vector<Layer> layers;
+
+      explicit GateLookupModel(const GateObjectModel& model) {
+         this->freeze(model);
+      }
+
+      // Precompute tables from the current model weights
+      void freeze(const GateObjectModel& model) {
+         layers.clear();
+         layers.resize(model.layers.size());
+         for (size_t l = 0; l < model.layers.size(); l++) {
+            auto source_layer = model.layers[l];
+            auto& layer = layers[l];
+            layer.size = source_layer->size();
+            layer.states.assign((layer.size + 63) / 64, 0);
+            layer.accumulators.assign(layer.size, 0);
+            for (auto& object : *source_layer) {
+               layer.bases.push_back(relaxed_load(object.gate.weight_base));
+            }
+            for (auto* connection : source_layer->inputs) {
+               layer.inputs.push_back(freeze_input(*connection));
+            }
+         }
+      }
+
+      // Write bit-packed states of a layer without input, eg. the first one
+      void write_states(size_t layer, const uint64_t* words) {
+         auto& states = layers[layer].states;
+         for (size_t w = 0; w < states.size(); w++) {
+            states[w] = words[w] & Kernels::word_mask(w, layers[layer].size);
+         }
+      }
+      // Write the first layer from bytes, as GateLayer::write_vec8
+      void write_vec8(const uint8_t* values) {
+         auto& states = layers[0].states;
+         size_t bytes_count = (layers[0].size + 7) / 8;
+         for (size_t w = 0; w < states.size(); w++) {
+            uint64_t word = 0;
+            for (size_t b = 0; b < 8 && w * 8 + b < bytes_count; b++) {
+               word |= uint64_t(values[w * 8 + b]) << (b * 8);
+            }
+            states[w] = word & Kernels::word_mask(w, layers[0].size);
+         }
+      }
+      bool get_state(size_t layer, size_t index) const {
+         return (layers[layer].states[index >> 6] >> (index & 63)) & 1;
+      }
+
+      void compute_forward() {
+         for (auto& layer : layers) {
+            if (layer.inputs.empty()) continue;
+            weight_sum_t* acc = layer.accumulators.data();
+            std::copy(layer.bases.begin(), layer.bases.end(), acc);
+            for (auto& input : layer.inputs) {
+               const uint64_t* source = layers[input.source].states.data();
+               if (!input.tables.empty()) {
+                  for (size_t b = 0; b < input.bytes_count; b++) {
+                     uint32_t value = (source[b >> 3] >> ((b & 7) * 8)) & 0xff;
+                     const table_t* row = &input.tables[(b * 256 + value) * layer.size];
+                     for (size_t i = 0; i < layer.size; i++) acc[i] += row[i];
+                  }
+               }
+               else {
+                  for (size_t i = 0; i < layer.size; i++) {
+                     const weight_t* row = &input.weights[input.links.get_weights_row(i) * input.width];
+                     if (input.links.pattern == GateLinks::Dense) acc[i] += Kernels::masked_sum(row, source, input.width);
+                     else acc[i] += input.links.masked_sums<Kernels::PlainSum>(row, i, source, input.indices.data());
+                  }
+               }
+            }
+            std::fill(layer.states.begin(), layer.states.end(), 0);
+            for (size_t i = 0; i < layer.size; i++) {
+               layer.states[i >> 6] |= uint64_t(acc[i] > 0) << (i & 63);
+            }
+         }
+      }
+
+   private:
+      static Input freeze_input(const GateConnection& connection) {
+         Input input;
+         input.source = connection.source->index;
+         input.width = connection.width;
+         input.bytes_count = (connection.width + 7) / 8;
+         input.links = connection.links;
+         input.indices.assign(connection.indices.begin(), connection.indices.end());
+
+         size_t height = connection.height;
+         std::vector<weight_t> weights(connection.weights.size());
+         weight_sum_t max_weight = 0;
+         for (size_t k = 0; k < weights.size(); k++) {
+            weights[k] = relaxed_load(connection.weights[k]);
+            max_weight = std::max<weight_sum_t>(max_weight, std::abs(weight_sum_t(weights[k])));
+         }
+
+         // A table entry sums up to 8 weights
+         size_t table_bytes = input.bytes_count * 256 * height * sizeof(table_t);
+         if (!connection.is_dense() || table_bytes > MaxTableBytes || max_weight * 8 > std::numeric_limits<table_t>::max()) {
+            input.weights = std::move(weights);
+            return input;
+         }
+         input.tables.assign(input.bytes_count * 256 * height, 0);
+         for (size_t b = 0; b < input.bytes_count; b++) {
+            size_t bits_count = std::min<size_t>(8, input.width - b * 8);
+            for (size_t i = 0; i < height; i++) {
+               const weight_t* row = &weights[i * input.width + b * 8];
+               // Entry v extends entry v without its lowest bit, by the weight of that bit
+               table_t* column = &input.tables[b * 256 * height + i];
+               for (uint32_t value = 1; value < 256; value++) {
+                  int bit = Kernels::count_trailing_zeros(value);
+                  table_t weight = size_t(bit) < bits_count ? table_t(row[bit]) : 0;
+                  column[value * height] = column[(value & (value - 1)) * height] + weight;
+               }
+            }
+         }
+         return input;
+      }
+   };
+
+}
@@ -0,0 +1,177 @@
+#pragma once
+
+#include "../math.h"
+#include "./GateRandom.h"
+#include <math.h>
+#include <algorithm>
+#include <limits>
+
+namespace ins {
+
+   // Stochastic weight mutation engine
+   // Mutation probabilities are unsigned Q8.24 fixed-point numbers, drawn against raw random bits.
+   struct GateMutation {
+      typedef uint32_t prob_t;
+
+      static constexpr int ProbBits = 24;
+      static constexpr prob_t ProbOne = prob_t(1) << ProbBits;
+      static constexpr prob_t ProbMax = ~prob_t(0);
+
+      // Probability bound above which testing every weight is cheaper than skip sampling
+      static constexpr prob_t DenseBound = ProbOne / 16;
+
+      // Upper bounds of the probabilities of a set of weights
+      struct Bounds {
+         prob_t neg = 0;
+         prob_t pos = 0;
+      };
+
+      static prob_t from_scalar(Scalar value) {
+         if (!(value > 0)) return 0;
+         if (value >= Scalar(ProbMax >> ProbBits)) return ProbMax;
+         return prob_t(value * Scalar(ProbOne));
+      }
+      static Scalar to_scalar(prob_t prob) {
+         return Scalar(prob) * (Scalar(1) / Scalar(ProbOne));
+      }
+      static prob_t add(prob_t a, prob_t b) {
+         prob_t r = a + b;
+         return r < a ? ProbMax : r;
+      }
+      static prob_t sub(prob_t a, prob_t b) {
+         return a > b ? a - b : 0;
+      }
+      static prob_t scale(prob_t a, Scalar factor) {
+         return from_scalar(to_scalar(a) * factor);
+      }
+      static prob_t clamp_one(prob_t a) {
+         return a > ProbOne ? ProbOne : a;
+      }
+
+      // Relaxed updates of a shared probability: a concurrent update may be lost, never torn
+      static void update_add(prob_t& prob, prob_t value) {
+         relaxed_store(prob, add(relaxed_load(prob), value));
+      }
+      static void update_sub(prob_t& prob, prob_t value) {
+         relaxed_store(prob, sub(relaxed_load(prob), value));
+      }
+
+      // Apply drawn mutations to a weight, and return true when it leaves [weight_min, weight_max]
+      // Weights and probabilities may be shared by concurrent trainers, so they are accessed relaxed.
+      template <class weight_t>
+      static bool apply(weight_t& weight, prob_t& neg, prob_t& pos, bool neg_hit, bool pos_hit, weight_t weight_min, weight_t weight_max) {
+         if (!(neg_hit || pos_hit)) return false;
+
+         // Saturate to the weight type range, as narrow weights may step past weight_max
+         constexpr int64_t saturation = std::numeric_limits<weight_t>::max();
+         bool has_overflowed = false;
+         int64_t value = relaxed_load(weight);
+         if (neg_hit) {
+            value--;
+            if (value < weight_min) has_overflowed = true;
+         }
+         if (pos_hit) {
+            value++;
+            if (value > weight_max) has_overflowed = true;
+         }
+         relaxed_store(weight, weight_t(std::min(std::max(value, -saturation), saturation)));
+         relaxed_store(neg, clamp_one(relaxed_load(neg) >> 1));
+         relaxed_store(pos, clamp_one(relaxed_load(pos) >> 1));
+         return has_overflowed;
+      }
+
+      // Draw both mutations of one weight from a single random word
+      static void draw(prob_t neg_value, prob_t pos_value, GateRandom& random, bool& neg_hit, bool& pos_hit) {
+         uint64_t bits = random.next();
+         neg_hit = prob_t(bits >> 40) < neg_value;
+         pos_hit = prob_t((bits >> 16) & (ProbOne - 1)) < pos_value;
+      }
+      template <class weight_t>
+      static bool mutate(weight_t& weight, prob_t& neg, prob_t& pos, weight_t weight_min, weight_t weight_max, GateRandom& random) {
+         prob_t neg_value = relaxed_load(neg);
+         prob_t pos_value = relaxed_load(pos);
+         if (!(neg_value | pos_value)) return false;
+         bool neg_hit, pos_hit;
+         draw(neg_value, pos_value, random, neg_hit, pos_hit);
+         return apply(weight, neg, pos, neg_hit, pos_hit, weight_min, weight_max);
+      }
+
+      // Geometric skip sampler: visits positions at rate 'bound', and accepts
+      // a visited position with rate prob / bound (thinning)
+      struct SkipSampler {
+         prob_t bound;
+         double inv_log_miss;
+         size_t count;
+
+         SkipSampler(prob_t bound, size_t count)
+            : bound(bound), count(count) {
+            double rate = to_scalar(bound);
+            inv_log_miss = rate >= 1.0 ? 0.0 : 1.0 / log1p(-rate);
+         }
+         // Next visited position after 'position', or count when none
+         size_t next(size_t position, GateRandom& random) {
+            size_t first = position + 1;
+            if (!bound || first >= count) return count;
+            double u = double((random.next() >> 11) + 1) * (1.0 / 9007199254740992.0);
+            double skip = floor(log(u) * inv_log_miss);
+            if (skip >= double(count - first)) return count;
+            return first + size_t(skip);
+         }
+         bool accept(prob_t prob, GateRandom& random) {
+            return uint64_t(random.next_u32() >> 8) * bound < (uint64_t(prob) << ProbBits);
+         }
+      };
+
+      // Mutate 'count' weights whose probabilities are bounded by 'neg_bound' and 'pos_bound'.
+      // Only weights drawn for mutation are touched unless the bounds are high.
+      // on_overflow(k) is called for each weight k which left [weight_min, weight_max].
+      // Returns the count of weights mutated.
+      template <class weight_t, class OverflowFn>
+      static size_t mutate_array(weight_t* weights, prob_t* neg, prob_t* pos, size_t count,
+         prob_t neg_bound, prob_t pos_bound, weight_t weight_min, weight_t weight_max,
+         GateRandom& random, OverflowFn on_overflow) {
+         return mutate_array(weights, neg, pos, count, 1, neg_bound, pos_bound, weight_min, weight_max, random, on_overflow);
+      }
+      // Same over weights and probabilities k * stride, eg. one lane of interleaved models
+      template <class weight_t, class OverflowFn>
+      static size_t mutate_array(weight_t* weights, prob_t* neg, prob_t* pos, size_t count, size_t stride,
+         prob_t neg_bound, prob_t pos_bound, weight_t weight_min, weight_t weight_max,
+         GateRandom& random, OverflowFn on_overflow) {
+         if (!(neg_bound | pos_bound)) return 0;
+
+         size_t mutations_count = 0;
+         if (neg_bound > DenseBound || pos_bound > DenseBound) {
+            for (size_t k = 0; k < count; k++) {
+               prob_t neg_value = relaxed_load(neg[k * stride]);
+               prob_t pos_value = relaxed_load(pos[k * stride]);
+               if (!(neg_value | pos_value)) continue;
+               bool neg_hit, pos_hit;
+               draw(neg_value, pos_value, random, neg_hit, pos_hit);
+               mutations_count += neg_hit || pos_hit;
+               if (apply(weights[k * stride], neg[k * stride], pos[k * stride], neg_hit, pos_hit, weight_min, weight_max)) on_overflow(k);
+            }
+            return mutations_count;
+         }
+
+         SkipSampler neg_sampler(neg_bound, count);
+         SkipSampler pos_sampler(pos_bound, count);
+         size_t next_neg = neg_sampler.next(size_t(-1), random);
+         size_t next_pos = pos_sampler.next(size_t(-1), random);
+         while (next_neg < count || next_pos < count) {
+            size_t k = next_neg < next_pos ? next_neg : next_pos;
+            bool neg_hit = false, pos_hit = false;
+            if (k == next_neg) {
+               neg_hit = neg_sampler.accept(relaxed_load(neg[k * stride]), random);
+               next_neg = neg_sampler.next(k, random);
+            }
+            if (k == next_pos) {
+               pos_hit = pos_sampler.accept(relaxed_load(pos[k * stride]), random);
+               next_pos = pos_sampler.next(k, random);
+            }
+            mutations_count += neg_hit || pos_hit;
+            if (apply(weights[k * stride], neg[k * stride], pos[k * stride], neg_hit, pos_hit, weight_min, weight_max)) on_overflow(k);
+         }
+         return mutations_count;
+      }
+   };
+}
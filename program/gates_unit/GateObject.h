@@ -1,347 +1,1050 @@
 #pragma once
 
 #include "../math.h"
+#include "../shapes.h"
+#include "./GateKernels.h"
+#include "./GateLinks.h"
+#include "./GateRandom.h"
+#include "./GateMutation.h"
+#include "./GateWorkers.h"
+#include "./GateArena.h"
+#include "./GateTelemetry.h"
 #include <functional>
 #include <memory>
+#include <memory_resource>
+#include <stdexcept>
 
-std::random_device generator;
-std::uniform_real_distribution<double> distribution_unsigned(0.0, 1.0);
-std::uniform_real_distribution<double> distribution_signed(-1.0, 1.0);
+// Bits of a link weight: 32 (default), 16, or 8 (experimental)
+// Narrow weights halve or quarter the weights bandwidth, and saturate instead of wrapping
+#ifndef INS_WEIGHT_BITS
+#define INS_WEIGHT_BITS 32
+#endif
 
 namespace ins {
+
+   // Bit-packed gate states: 64 gates per word, gate i at bit (i % 64) of word (i / 64)
+   struct GateStates : std::pmr::vector<uint64_t> {
+      explicit GateStates(const allocator_type& allocator = allocator_type())
+         : vector(allocator) {
+      }
+      void resize_bits(size_t count) {
+         this->assign((count + 63) / 64, 0);
+      }
+      bool get(size_t index) const {
+         return ((*this)[index >> 6] >> (index & 63)) & 1;
+      }
+      void set(size_t index, bool value) {
+         uint64_t mask = uint64_t(1) << (index & 63);
+         auto& word = (*this)[index >> 6];
+         word = value ? (word | mask) : (word & ~mask);
+      }
+   };
+
    struct GateObject {
 
+#if INS_WEIGHT_BITS == 8
+      // 8 bits leave few steps between init and overflow, so downscale keeps more of the weights
+      typedef int8_t weight_t;
+      static constexpr weight_t WeightMax = 120;
+      static constexpr double DownscaleFactor = 0.75;
+#elif INS_WEIGHT_BITS == 16
+      typedef int16_t weight_t;
+      static constexpr weight_t WeightMax = 10000;
+      static constexpr double DownscaleFactor = 0.5;
+#elif INS_WEIGHT_BITS == 32
       typedef int32_t weight_t;
+      static constexpr weight_t WeightMax = 10000;
+      static constexpr double DownscaleFactor = 0.5;
+#else
+#error "INS_WEIGHT_BITS shall be 8, 16 or 32"
+#endif
       typedef int64_t weight_sum_t;
+      typedef GateMutation::prob_t mut_prob_t;
 
-      static constexpr weight_t WeightMax = 10000;
       static constexpr weight_t WeightMin = -WeightMax;
+      static constexpr weight_t WeightInit = WeightMax / 10; // initial weights range
 
       struct Gate {
          weight_t weight_base = 0;
 
-         Scalar mut_prob_neg = 0;
-         Scalar mut_prob_pos = 0;
+         mut_prob_t mut_prob_neg = 0;
+         mut_prob_t mut_prob_pos = 0;
+      };
+
+      // Feedback distribution params of a gate over its links
+      struct Feedback {
+         Scalar signal = 0;
+         mut_prob_t prob = 0;
+         Scalar factor = 0;
+         Scalar offset = 0;
+         bool state = 0;
 
-         Scalar feedback_signal = 0;
+         static constexpr Scalar reward_damping = 0.0;
+
+         // Integrate feedback to one link stats, and return the feedback to dispatch to its input
+         // Link probabilities are private copies, the shared gate stats are updated relaxed.
+         Scalar integrate_link(Gate& gate, bool input, weight_t weight, mut_prob_t& mut_prob_neg, mut_prob_t& mut_prob_pos) const {
+            Scalar lfeedback = 0;
+            if (input) {
+               if (signal > 0) {
+                  GateMutation::update_sub(gate.mut_prob_neg, GateMutation::scale(prob, reward_damping));
+                  GateMutation::update_sub(gate.mut_prob_pos, GateMutation::scale(prob, reward_damping));
+                  lfeedback = offset + signal * abs(weight) * factor;
+               }
+               else {
+                  lfeedback = offset + signal * weight * factor;
+                  if (state == 0) {
+                     mut_prob_pos = GateMutation::add(mut_prob_pos, prob);
+                  }
+                  else {
+                     mut_prob_neg = GateMutation::add(mut_prob_neg, prob);
+                  }
+               }
+            }
+            else {
+               if (signal > 0) {
+                  mut_prob_neg = GateMutation::scale(mut_prob_neg, reward_damping);
+                  mut_prob_pos = GateMutation::scale(mut_prob_pos, reward_damping);
+                  lfeedback = offset + signal * abs(weight) * factor;
+               }
+               else {
+                  lfeedback = -offset + signal * weight * factor;
+                  if (state == 0) {
+                     mut_prob_neg = GateMutation::add(mut_prob_neg, prob);
+                  }
+                  else {
+                     mut_prob_pos = GateMutation::add(mut_prob_pos, prob);
+                  }
+               }
+            }
+            mut_prob_pos = GateMutation::clamp_one(mut_prob_pos);
+            mut_prob_neg = GateMutation::clamp_one(mut_prob_neg);
+            return lfeedback;
+         }
       };
 
-      struct Link {
-         GateObject& source;
+      Gate gate;
 
-         weight_t weight = 0;
+      void initialize(GateRandom& random) {
+#if 1
+         gate.weight_base = random.uniform_signed() * WeightInit;
+#else
+         gate.weight_base = 0;
+#endif
+      }
+
+      // Integrate the gate feedback signal to gate stats, and return its distribution params over links
+      Feedback integrate_feedback(Scalar feedback_signal, bool state, weight_sum_t links_weights_sum, size_t links_count) {
+         Feedback feedback;
+         feedback.signal = feedback_signal;
+         feedback.state = state;
 
-         Scalar mut_prob_neg = 0;
-         Scalar mut_prob_pos = 0;
+         // Compute feedback distribution params
+         feedback.prob = GateMutation::from_scalar(1.0 * std::abs(feedback.signal));
+         feedback.factor = links_weights_sum > 0 ? (0.99 / Scalar(links_weights_sum)) : 0;
+         feedback.offset = (1.0 - feedback.factor * links_weights_sum) / Scalar(links_count);
 
-         Link(GateObject& source)
-            : source(source) {
+         // Integrate feedback to gate stats
+         if (feedback.signal > 0) {
+            GateMutation::update_sub(gate.mut_prob_neg, GateMutation::scale(feedback.prob, Feedback::reward_damping));
+            GateMutation::update_sub(gate.mut_prob_pos, GateMutation::scale(feedback.prob, Feedback::reward_damping));
          }
-      };
+         else {
+            if (state == 0) {
+               GateMutation::update_add(gate.mut_prob_pos, feedback.prob);
+            }
+            else {
+               GateMutation::update_add(gate.mut_prob_neg, feedback.prob);
+            }
+         }
+         return feedback;
+      }
+      static bool mutate_weight(weight_t& weight, mut_prob_t& mut_prob_neg, mut_prob_t& mut_prob_pos, GateRandom& random) {
+         return GateMutation::mutate(weight, mut_prob_neg, mut_prob_pos, WeightMin, WeightMax, random);
+      }
+      static weight_t downscale_weight(weight_t weight) {
+         return round(double(weight) * DownscaleFactor);
+      }
+      static void downscale_weight_shared(weight_t& weight) {
+         relaxed_store(weight, downscale_weight(relaxed_load(weight)));
+      }
+   };
 
-      bool state = 0;
+   struct GateLayer;
 
-      Gate gate;
-      std::vector<Link> links;
+   // Links from a source layer to a target layer, dense or following a sparse pattern (see GateLinks)
+   // Weights and stats are row-major matrices: row i holds the links of target gate i, or of its map
+   // when shared, and column k is link k of the row, linked to source gate k when dense.
+   struct GateConnection {
+      typedef GateObject::weight_t weight_t;
+      typedef GateObject::weight_sum_t weight_sum_t;
+      typedef GateObject::mut_prob_t mut_prob_t;
 
-      void emit_feeback(Scalar feedback_signal) {
-         if (links.size() == 0) return;
+      GateLayer* source;
+      GateLayer* target;
+      size_t width;  // links per row, ie. source gates count when dense
+      size_t height; // rows count, ie. target gates count
+      GateLinks links;
+      size_t shared_rows; // target gates sharing a weights row, ie. positions count when shared, else 1
 
-         gate.feedback_signal += feedback_signal;
+      std::pmr::vector<weight_t> weights;
+      std::pmr::vector<mut_prob_t> mut_prob_neg;
+      std::pmr::vector<mut_prob_t> mut_prob_pos;
+      std::pmr::vector<uint32_t> indices; // source gates of the links of a Random pattern
+
+      GateConnection(GateLayer* source, GateLayer* target, size_t width, size_t height, std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+         : GateConnection(source, target, GateLinks::dense(width), height, resource) {
       }
-      void initialize() {
+      GateConnection(GateLayer* source, GateLayer* target, const GateLinks& links, size_t height, std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+         : source(source), target(target), width(links.fan_in), height(height), links(links),
+         shared_rows(links.is_shared() ? links.get_positions_count() : 1),
+         weights(width * links.get_weights_rows_count(height), resource),
+         mut_prob_neg(weights.size(), resource), mut_prob_pos(weights.size(), resource),
+         indices(links.get_indices_count(height), resource) {
+      }
+      bool is_dense() const {
+         return links.pattern == GateLinks::Dense;
+      }
+      size_t get_weights_row(size_t row) const {
+         return links.is_shared() ? row / shared_rows : row;
+      }
+      const weight_t* get_row_weights(size_t row) const {
+         return &weights[this->get_weights_row(row) * width];
+      }
+      // Source gate of link k of a row
+      size_t get_source(size_t row, size_t k) const {
+         return links.get_source(row, k, indices.data());
+      }
+      void initialize(GateRandom& random) {
+         for (auto& weight : weights) {
 #if 1
-         for (auto& link : links) {
-            link.weight = random_signed() * 1000;
-         }
-         gate.weight_base = random_signed() * 1000;
+            weight = random.uniform_signed() * GateObject::WeightInit;
 #else
-         for (auto& link : links) {
-            link.weight = 0;
-         }
-         gate.weight_base = 0;
+            weight = 0;
 #endif
+         }
+      }
+      weight_sum_t compute_forward(size_t row, const GateStates& inputs) const {
+         if (!this->is_dense()) return this->compute_sparse_sums<Kernels::PlainSum>(row, inputs);
+         return Kernels::masked_sum(&weights[row * width], inputs.data(), width);
+      }
+      // Bit-sliced forward of 64 samples: add row weights of active input lanes to
+      // positive and negative lanes sums
+      void compute_forward_batch(size_t row, const uint64_t* input_lanes, uint64_t* pos_planes, uint64_t* neg_planes, int planes_count) const {
+         const weight_t* row_weights = this->get_row_weights(row);
+         bool dense = this->is_dense();
+         for (size_t k = 0; k < width; k++) {
+            weight_t weight = row_weights[k];
+            uint64_t mask = input_lanes[dense ? k : this->get_source(row, k)];
+            if (!mask || !weight) continue;
+            if (weight > 0) Kernels::bitsliced_add(pos_planes, planes_count, uint64_t(weight), mask);
+            else Kernels::bitsliced_add(neg_planes, planes_count, uint64_t(-int64_t(weight)), mask);
+         }
+      }
+      // Add (or subtract when inactive) the weights of the links of source gate k to the rows accumulators
+      // Requires links.has_columns().
+      void accumulate_column(size_t k, bool active, weight_sum_t* accumulators) const {
+         if (!this->is_dense()) {
+            weight_sum_t sign = active ? 1 : -1;
+            links.for_each_link(k, height, [&](size_t row, size_t link) {
+               accumulators[row] += sign * relaxed_load(this->get_row_weights(row)[link]);
+               });
+            return;
+         }
+         const weight_t* column = &weights[k];
+         if (active) {
+            for (size_t i = 0; i < height; i++) accumulators[i] += relaxed_load(column[i * width]);
+         }
+         else {
+            for (size_t i = 0; i < height; i++) accumulators[i] -= relaxed_load(column[i * width]);
+         }
+      }
+      weight_sum_t compute_weights_sum(size_t row, const GateStates& inputs) const {
+         if (!this->is_dense()) return this->compute_sparse_sums<Kernels::AbsoluteSum>(row, inputs);
+         return Kernels::masked_abs_sum(&weights[row * width], inputs.data(), width);
+      }
+      // Forward sum of the row, with its weights sum set to 'weights_sum', in a single pass over the weights
+      weight_sum_t compute_sums(size_t row, const GateStates& inputs, weight_sum_t& weights_sum) const {
+         if (!this->is_dense()) return this->compute_sparse_sums<Kernels::BothSums>(row, inputs, &weights_sum);
+         return Kernels::masked_sums(&weights[row * width], inputs.data(), width, weights_sum);
+      }
+      template <Kernels::SumMode mode>
+      weight_sum_t compute_sparse_sums(size_t row, const GateStates& inputs, weight_sum_t* weights_sum = 0) const {
+         return links.masked_sums<mode>(this->get_row_weights(row), row, inputs.data(), indices.data(), weights_sum);
       }
 
-      void compute_forward() {
-         if (links.size() == 0) return;
+      //--- Bit planes of shared kernels of at most 64 links
+      // Per map: the planes count, then planes p of the positive and the negative weights magnitudes
+      // interleaved, bit k of plane p being bit p of the magnitude of link k (see Kernels::planes_sums).
+      // The planes are followed by the window states of each position, gathered once for all the maps,
+      // so that a row sum is a few ANDs and popcounts.
+      static constexpr size_t PlanesMax = sizeof(weight_t) * 8;
+      static constexpr size_t PlanesStride = 1 + 2 * PlanesMax;
 
-         weight_sum_t acc = gate.weight_base;
-         for (auto& link : links) {
-            if (link.source.state) acc += link.weight;
+      bool has_planes() const {
+         return links.is_shared() && width <= 64;
+      }
+      size_t get_planes_size() const {
+         return this->has_planes() ? (weights.size() / width) * PlanesStride + shared_rows : 0;
+      }
+      void build_planes(uint64_t* planes, const GateStates& inputs) const {
+         size_t maps_count = weights.size() / width;
+         for (size_t m = 0; m < maps_count; m++) {
+            uint64_t* map_planes = planes + m * PlanesStride;
+            std::fill(map_planes + 1, map_planes + PlanesStride, 0);
+            uint64_t magnitudes = 0;
+            for (size_t k = 0; k < width; k++) {
+               int64_t weight = relaxed_load(weights[m * width + k]);
+               uint64_t magnitude = uint64_t(weight < 0 ? -weight : weight);
+               uint64_t* target = map_planes + 1 + (weight < 0);
+               for (size_t p = 0; magnitude >> p; p++) target[2 * p] |= ((magnitude >> p) & 1) << k;
+               magnitudes |= magnitude;
+            }
+            size_t planes_count = 0;
+            while (magnitudes >> planes_count) planes_count++;
+            map_planes[0] = planes_count;
          }
-         this->state = (acc > 0);
+         links.gather_patches(inputs.data(), planes + maps_count * PlanesStride);
+      }
+      // Forward sum of a row from the planes of its map, with its weights sum set to 'weights_sum'
+      weight_sum_t compute_planes_sums(size_t row, const uint64_t* planes, weight_sum_t& weights_sum) const {
+         size_t map = row / shared_rows;
+         const uint64_t* map_planes = planes + map * PlanesStride;
+         uint64_t bits = planes[(weights.size() / width) * PlanesStride + row - map * shared_rows];
+         return Kernels::planes_sums(map_planes + 1, map_planes[0], bits, weights_sum);
       }
 
-      void compute_backward() {
-         if (links.size() == 0) return;
+      // Integrate feedback to row links stats, and dispatch link feedback to 'feedbacks' when not null
+      // Shared rows integrate the feedback of all the positions of their map.
+      void compute_backward(size_t row, GateObject::Gate& gate, const GateObject::Feedback& feedback, const GateStates& inputs, Scalar* feedbacks, GateMutation::Bounds& bounds) {
+         size_t offset = this->get_weights_row(row) * width;
+         weight_t* row_weights = &weights[offset];
+         mut_prob_t* row_mut_prob_neg = &mut_prob_neg[offset];
+         mut_prob_t* row_mut_prob_pos = &mut_prob_pos[offset];
+         mut_prob_t neg_bound = bounds.neg;
+         mut_prob_t pos_bound = bounds.pos;
+         bool dense = this->is_dense();
+         for (size_t base = 0; base < width; base += 64) {
+            size_t count = std::min<size_t>(64, width - base);
+            uint64_t bits = links.gather(row, base, count, inputs.data(), indices.data());
+            for (size_t k = base; k < base + count; k++) {
+               mut_prob_t neg = relaxed_load(row_mut_prob_neg[k]);
+               mut_prob_t pos = relaxed_load(row_mut_prob_pos[k]);
+               Scalar lfeedback = feedback.integrate_link(gate, (bits >> (k - base)) & 1, relaxed_load(row_weights[k]), neg, pos);
+               relaxed_store(row_mut_prob_neg[k], neg);
+               relaxed_store(row_mut_prob_pos[k], pos);
+               neg_bound = std::max(neg_bound, neg);
+               pos_bound = std::max(pos_bound, pos);
+               if (feedbacks) feedbacks[dense ? k : this->get_source(row, k)] += lfeedback;
+            }
+         }
+         bounds.neg = neg_bound;
+         bounds.pos = pos_bound;
+      }
+      // Mutate the weights of rows [row_begin, row_end), and mark in 'overflows' the rows which overflowed
+      // 'bounds' shall hold the probabilities of these rows. Returns the count of weights mutated.
+      // Shared kernels are mutated once for the rows of their map, their first row marking an overflow.
+      size_t mutate_weights(size_t row_begin, size_t row_end, const GateMutation::Bounds& bounds, GateRandom& random, GateStates& overflows) {
+         if (row_begin == row_end) return 0;
+         size_t weights_begin = this->get_weights_row(row_begin);
+         size_t weights_end = this->get_weights_row(row_end - 1) + 1;
+         size_t offset = weights_begin * width;
+         return GateMutation::mutate_array(&weights[offset], &mut_prob_neg[offset], &mut_prob_pos[offset], (weights_end - weights_begin) * width,
+            bounds.neg, bounds.pos, GateObject::WeightMin, GateObject::WeightMax,
+            random, [&](size_t k) { overflows.set((weights_begin + k / width) * shared_rows, 1); });
+      }
+      // Mark every row of a shared map when one of its rows overflowed, as the rows of a map sum the same
+      // kernel: the kernel downscales with all their biases. Returns true when rows were marked.
+      bool spread_overflows(size_t row_begin, size_t row_end, GateStates& overflows) const {
+         if (shared_rows == 1) return false;
+         bool spread = false;
+         for (size_t map_begin = row_begin - row_begin % shared_rows; map_begin < row_end; map_begin += shared_rows) {
+            size_t first = std::max(map_begin, row_begin);
+            size_t last = std::min(map_begin + shared_rows, row_end);
+            size_t count = 0;
+            for (size_t i = first; i < last; i++) count += overflows.get(i);
+            if (count == 0 || count == last - first) continue;
+            for (size_t i = first; i < last; i++) overflows.set(i, 1);
+            spread = true;
+         }
+         return spread;
+      }
+      // Downscale the weights of a row, a shared kernel only once from the first row of its map
+      void downscale_weights(size_t row) {
+         if (row % shared_rows) return;
+         weight_t* row_weights = &weights[this->get_weights_row(row) * width];
+         for (size_t k = 0; k < width; k++) {
+            GateObject::downscale_weight_shared(row_weights[k]);
+         }
+      }
+   };
 
-         // Flush integrated feedback signal
-         auto feedback = gate.feedback_signal;
-         gate.feedback_signal = 0;
+   // Per-sample evaluation state of a layer
+   struct GateLayerState {
+      typedef std::pmr::polymorphic_allocator<char> allocator_type;
 
-         // Compute links weights sum
-         weight_sum_t links_weights_sum = gate.weight_base;
-         for (auto& link : links) {
-            if (link.source.state) links_weights_sum += abs(link.weight);
-         }
+      GateStates states;
+      GateStates changes; // gates flipped since the accumulators were last propagated
+      std::pmr::vector<GateObject::weight_sum_t> accumulators; // per gate, weights sum of the last forward
+      std::pmr::vector<GateObject::weight_sum_t> weights_sums; // per gate, absolute links weights sum of the last forward
+      bool summed = false; // weights_sums match the states and weights, see compute_backward_range
+      GateStates overflows; // gates whose weights overflowed during mutation
+      std::pmr::vector<Scalar> feedback_signals; // feedback integrated per gate until backward
+      std::pmr::vector<uint64_t> batch_states; // per gate, bit s is the state for batch sample s
+      std::pmr::vector<uint64_t> planes; // kernels bit planes of the inputs which have some, see GateLayer::build_planes
 
-         // Compute feedback distribution params
-         Scalar feedback_prob = 1.0 * std::abs(feedback);
-         Scalar feedback_factor = links_weights_sum > 0 ? (0.99 / Scalar(links_weights_sum)) : 0;
-         Scalar feedback_offset = (1.0 - feedback_factor * links_weights_sum) / Scalar(links.size());
-         Scalar reward_damping = 0.0;
+      // Backward scratch, per input and per range: feedback targets and buffers, mutation bounds
+      std::pmr::vector<Scalar*> feedback_targets;
+      std::pmr::vector<Scalar> feedback_buffers;
+      std::pmr::vector<GateMutation::Bounds> bounds_buffers;
 
-         // Integrate feedback to stats
-         //--- integrate to gate stats
-         {
-            if (feedback > 0) {
-               gate.mut_prob_neg -= feedback_prob * reward_damping;
-               gate.mut_prob_pos -= feedback_prob * reward_damping;
+      GateLayerState(size_t count, const allocator_type& allocator = allocator_type())
+         : states(allocator), changes(allocator), accumulators(count, allocator), weights_sums(count, allocator), overflows(allocator),
+         feedback_signals(count, allocator), batch_states(count, allocator), planes(allocator),
+         feedback_targets(allocator), feedback_buffers(allocator), bounds_buffers(allocator) {
+         states.resize_bits(count);
+         changes.resize_bits(count);
+         overflows.resize_bits(count);
+      }
+      GateLayerState(GateLayerState&& other, const allocator_type& allocator)
+         : states(allocator), changes(allocator), accumulators(std::move(other.accumulators), allocator),
+         weights_sums(std::move(other.weights_sums), allocator), summed(other.summed), overflows(allocator),
+         feedback_signals(std::move(other.feedback_signals), allocator), batch_states(std::move(other.batch_states), allocator),
+         planes(std::move(other.planes), allocator),
+         feedback_targets(std::move(other.feedback_targets), allocator), feedback_buffers(std::move(other.feedback_buffers), allocator),
+         bounds_buffers(std::move(other.bounds_buffers), allocator) {
+         states.assign(other.states.begin(), other.states.end());
+         changes.assign(other.changes.begin(), other.changes.end());
+         overflows.assign(other.overflows.begin(), other.overflows.end());
+      }
+   };
+
+   // Evaluation state of a model: the states of its layers and the stream drawn for mutations
+   // Model parameters are shared, so each thread evaluating or training a model uses its own context.
+   struct GateContext {
+      std::pmr::vector<GateLayerState> layers; // indexed by GateLayer::index
+      GateRandom random;
+      bool accumulated = false; // accumulators match the states and weights, see compute_forward_delta
+
+      explicit GateContext(std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+         : layers(resource) {
+      }
+      GateLayerState& get(const GateLayer* layer);
+   };
+
+   struct GateLayer : std::pmr::vector<GateObject> {
+      typedef GateObject::weight_sum_t weight_sum_t;
+
+      // Minimum links count of a layer to split its compute over workers
+      static constexpr size_t ParallelLinksCount = 1 << 14;
+
+      // Links per flipped input above which a delta forward is cheaper than a full one
+      static constexpr size_t DeltaLinksRatio = 16;
+
+      int level = 0;
+      size_t index = 0; // rank in the model layers, which addresses its state in contexts
+      std::pmr::vector<GateConnection*> inputs;
+
+      GateLayer(int count, int level, std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+         : vector(count, resource), level(level), inputs(resource) {
+      }
+      void emit_feeback(GateContext& context, Span<const Scalar> feedbacks) {
+         if (feedbacks.size != this->size()) throw std::invalid_argument("GateLayer::emit_feeback: one feedback per gate expected");
+         if (this->inputs.empty()) return;
+
+         auto& feedback_signals = context.get(this).feedback_signals;
+         for (size_t i = 0; i < feedbacks.size; i++) {
+            feedback_signals[i] += feedbacks[i];
+         }
+      }
+      void write_vec8(GateContext& context, Span<const uint8_t> values) {
+         if (values.size * 8 != this->size()) throw std::invalid_argument("GateLayer::write_vec8: one byte per 8 gates expected");
+
+         // Pack bytes little-endian into state words
+         auto& state = context.get(this);
+         for (size_t w = 0; w < state.states.size(); w++) {
+            uint64_t word = 0;
+            for (size_t b = 0; b < 8 && w * 8 + b < values.size; b++) {
+               word |= uint64_t(values[w * 8 + b]) << (b * 8);
             }
-            else {
-               if (this->state == 0) {
-                  gate.mut_prob_pos += feedback_prob;
-               }
-               else {
-                  gate.mut_prob_neg += feedback_prob;
+            state.changes[w] |= state.states[w] ^ word;
+            state.states[w] = word;
+         }
+      }
+      // Write a batch of up to 64 samples, sample s bytes are at values[s * stride]
+      void write_vec8_batch(GateContext& context, const uint8_t* values, size_t stride, size_t count) {
+         if (count > 64) throw std::invalid_argument("GateLayer::write_vec8_batch: at most 64 samples expected");
+
+         auto& batch_states = context.get(this).batch_states;
+         std::fill(batch_states.begin(), batch_states.end(), 0);
+         size_t bytes_count = this->size() / 8;
+         for (size_t s = 0; s < count; s++) {
+            const uint8_t* sample = values + s * stride;
+            for (size_t b = 0; b < bytes_count; b++) {
+               uint32_t byte = sample[b];
+               while (byte) {
+                  batch_states[b * 8 + Kernels::count_trailing_zeros(byte)] |= uint64_t(1) << s;
+                  byte &= byte - 1;
                }
             }
          }
-         //--- integrate to links stats
-         Scalar links_feedback = 0;
-         for (auto& link : links) {
+      }
+      void initialize(GateRandom& random) {
+         for (auto& gate : (*this)) {
+            gate.initialize(random);
+         }
+      }
+      size_t get_links_count() const {
+         size_t count = 0;
+         for (auto* input : this->inputs) count += input->width;
+         return count;
+      }
+      // Whether the links of each input gate can be listed, which the delta forward requires
+      bool has_columns() const {
+         for (auto* input : this->inputs) {
+            if (!input->links.has_columns()) return false;
+         }
+         return true;
+      }
+      // Whether an input shares weights between gates, whose backward then stays serial
+      bool has_shared_weights() const {
+         for (auto* input : this->inputs) {
+            if (input->links.is_shared()) return true;
+         }
+         return false;
+      }
+      // Workers to use for this layer, or null when too small to be worth splitting
+      GateWorkerPool* get_workers(GateWorkerPool* workers) const {
+         if (!workers || workers->size() < 2 || this->size() <= 64) return 0;
+         return this->size() * this->get_links_count() >= ParallelLinksCount ? workers : 0;
+      }
 
-            // Compute link feedback
-            Scalar lfeedback = 0;
-            if (link.source.state == 1) {
-               if (feedback > 0) {
-                  gate.mut_prob_neg -= feedback_prob * reward_damping;
-                  gate.mut_prob_pos -= feedback_prob * reward_damping;
-                  lfeedback = feedback_offset + feedback * abs(link.weight) * feedback_factor;
-               }
-               else {
-                  lfeedback = feedback_offset + feedback * link.weight * feedback_factor;
-                  if (this->state == 0) {
-                     link.mut_prob_pos += feedback_prob;
+      // Evaluate gates [begin, end), with begin and end aligned on 64 except at layer end
+      // The links weights sums needed by the backward are accumulated in the same pass.
+      // Requires the planes built by build_planes.
+      void compute_forward_range(GateContext& context, size_t begin, size_t end) {
+         auto& state = context.get(this);
+         for (size_t base = begin; base < end; base += 64) {
+            size_t last = std::min(base + 64, end);
+            uint64_t word = 0;
+            for (size_t i = base; i < last; i++) {
+               weight_sum_t acc = relaxed_load((*this)[i].gate.weight_base);
+               weight_sum_t weights_sum = 0;
+               const uint64_t* planes = state.planes.data();
+               for (auto* input : this->inputs) {
+                  weight_sum_t input_weights_sum;
+                  if (input->has_planes()) {
+                     acc += input->compute_planes_sums(i, planes, input_weights_sum);
+                     planes += input->get_planes_size();
                   }
                   else {
-                     link.mut_prob_neg += feedback_prob;
+                     acc += input->compute_sums(i, context.get(input->source).states, input_weights_sum);
                   }
+                  weights_sum += input_weights_sum;
                }
+               state.accumulators[i] = acc;
+               state.weights_sums[i] = weights_sum;
+               word |= uint64_t(acc > 0) << (i - base);
             }
-            else {
-               if (feedback > 0) {
-                  link.mut_prob_neg *= reward_damping;
-                  link.mut_prob_pos *= reward_damping;
-                  lfeedback = feedback_offset + feedback * abs(link.weight) * feedback_factor;
+            state.states[base / 64] = word;
+         }
+      }
+      // Build the bit planes of the shared kernels of the inputs, from their current weights and states
+      void build_planes(GateContext& context) {
+         auto& planes = context.get(this).planes;
+         size_t size = 0;
+         for (auto* input : this->inputs) size += input->get_planes_size();
+         if (size == 0) return;
+         planes.resize(size);
+         size_t offset = 0;
+         for (auto* input : this->inputs) {
+            if (!input->has_planes()) continue;
+            input->build_planes(&planes[offset], context.get(input->source).states);
+            offset += input->get_planes_size();
+         }
+      }
+      void compute_forward(GateContext& context, GateWorkerPool* workers = 0) {
+         if (this->get_links_count() == 0) return;
+         INS_TELEMETRY_TIMER(this->index, Forward);
+         INS_TELEMETRY_COUNT(this->index, Forwards, 1);
+
+         this->build_planes(context);
+
+         // Evaluate gates by groups of 64 to write whole state words
+         if (auto pool = this->get_workers(workers)) {
+            auto task = [&](size_t begin, size_t end, size_t) { this->compute_forward_range(context, begin, end); };
+            pool->run_ranges(this->size(), 64, task);
+         }
+         else {
+            this->compute_forward_range(context, 0, this->size());
+         }
+         context.get(this).summed = true;
+      }
+      // Incremental forward: adjust accumulators by the weights of the flipped inputs only,
+      // then threshold them again when touched. Flipped gates are added to the layer changes.
+      // When many inputs flipped, or an input has random links, the full forward is used instead.
+      void compute_forward_delta(GateContext& context) {
+         auto& state = context.get(this);
+         size_t flips_count = 0;
+         for (auto* input : this->inputs) {
+            for (auto word : context.get(input->source).changes) flips_count += Kernels::count_bits(word);
+         }
+         if (flips_count == 0) return;
+         INS_TELEMETRY_TIMER(this->index, DeltaForward);
+         INS_TELEMETRY_COUNT(this->index, DeltaForwards, 1);
+         INS_TELEMETRY_COUNT(this->index, DeltaFlips, flips_count);
+
+         if (flips_count * DeltaLinksRatio > this->get_links_count() || !this->has_columns()) {
+            this->build_planes(context);
+            for (size_t base = 0; base < this->size(); base += 64) {
+               uint64_t previous = state.states[base / 64];
+               this->compute_forward_range(context, base, std::min(base + 64, this->size()));
+               state.changes[base / 64] |= previous ^ state.states[base / 64];
+            }
+            state.summed = true;
+            return;
+         }
+         state.summed = false;
+         for (auto* input : this->inputs) {
+            auto& source = context.get(input->source);
+            for (size_t w = 0; w < source.changes.size(); w++) {
+               for (uint64_t bits = source.changes[w]; bits; bits &= bits - 1) {
+                  size_t k = w * 64 + Kernels::count_trailing_zeros(bits);
+                  input->accumulate_column(k, source.states.get(k), state.accumulators.data());
                }
-               else {
-                  lfeedback = -feedback_offset + feedback * link.weight * feedback_factor;
-                  if (this->state == 0) {
-                     link.mut_prob_neg += feedback_prob;
-                  }
-                  else {
-                     link.mut_prob_pos += feedback_prob;
-                  }
+            }
+         }
+         for (size_t base = 0; base < this->size(); base += 64) {
+            size_t last = std::min(base + 64, this->size());
+            uint64_t word = 0;
+            for (size_t i = base; i < last; i++) {
+               word |= uint64_t(state.accumulators[i] > 0) << (i - base);
+            }
+            state.changes[base / 64] |= state.states[base / 64] ^ word;
+            state.states[base / 64] = word;
+         }
+      }
+      // Bit-sliced forward of the 64 samples of batch_states
+      void compute_forward_batch(GateContext& context) {
+         size_t links_count = this->get_links_count();
+         if (links_count == 0) return;
+
+         // Lanes sums are split in positive and negative parts, both bounded by links and base weights
+         uint64_t max_sum = uint64_t(links_count + 1) * uint64_t(GateObject::WeightMax + 1);
+         int planes_count = 1;
+         while (planes_count < 64 && (max_sum >> planes_count)) planes_count++;
+
+         auto& batch_states = context.get(this).batch_states;
+         uint64_t pos_planes[64];
+         uint64_t neg_planes[64];
+         for (size_t i = 0; i < this->size(); i++) {
+            auto weight_base = relaxed_load((*this)[i].gate.weight_base);
+            Kernels::bitsliced_fill(pos_planes, planes_count, weight_base > 0 ? uint64_t(weight_base) : 0);
+            Kernels::bitsliced_fill(neg_planes, planes_count, weight_base < 0 ? uint64_t(-int64_t(weight_base)) : 0);
+            for (auto* input : this->inputs) {
+               input->compute_forward_batch(i, context.get(input->source).batch_states.data(), pos_planes, neg_planes, planes_count);
+            }
+            batch_states[i] = Kernels::bitsliced_greater(pos_planes, neg_planes, planes_count);
+         }
+      }
+
+      // Integrate feedback and mutate weights of gates [begin, end), with begin and end aligned on 64
+      // except at layer end. Link feedback to input c is dispatched to feedbacks[c] when not null,
+      // and bounds[c] is used as scratch for mutation bounds.
+      void compute_backward_range(GateContext& context, size_t begin, size_t end, Scalar* const* feedbacks, GateMutation::Bounds* bounds, GateRandom& random) {
+         auto& state = context.get(this);
+         size_t links_count = this->get_links_count();
+         for (size_t c = 0; c < this->inputs.size(); c++) {
+            bounds[c] = GateMutation::Bounds();
+         }
+
+         for (size_t i = begin; i < end; i++) {
+            auto& gate = (*this)[i].gate;
+
+            // Compute links weights sum, unless the forward already did
+            weight_sum_t links_weights_sum = relaxed_load(gate.weight_base);
+            if (state.summed) {
+               links_weights_sum += state.weights_sums[i];
+            }
+            else {
+               for (auto* input : this->inputs) {
+                  links_weights_sum += input->compute_weights_sum(i, context.get(input->source).states);
                }
             }
-            link.mut_prob_pos = clamp<Scalar>(link.mut_prob_pos, 0, 1);
-            link.mut_prob_neg = clamp<Scalar>(link.mut_prob_neg, 0, 1);
 
-            // Dispatch feedback to link input stats
-            link.source.emit_feeback(lfeedback);
+            // Flush integrated feedback signal, and integrate it to stats
+            INS_TELEMETRY_COUNT(this->index, FeedbackMagnitude, uint64_t(std::abs(state.feedback_signals[i]) * GateTelemetry::FeedbackUnit));
+            auto feedback = (*this)[i].integrate_feedback(state.feedback_signals[i], state.states.get(i), links_weights_sum, links_count);
+            state.feedback_signals[i] = 0;
+            for (size_t c = 0; c < this->inputs.size(); c++) {
+               auto input = this->inputs[c];
+               input->compute_backward(i, gate, feedback, context.get(input->source).states, feedbacks[c], bounds[c]);
+            }
          }
 
          // Mutate weights
-         bool overflowed = false;
-         //--- mutate gate weight base
-         overflowed |= mutate_weight(gate.weight_base, gate.mut_prob_neg, gate.mut_prob_pos);
-         //--- mutate links weight
-         for (auto& link : links) {
-            overflowed |= mutate_weight(link.weight, link.mut_prob_neg, link.mut_prob_pos);
+         INS_TELEMETRY_TIMER(this->index, Mutation);
+         auto& overflows = state.overflows;
+         for (size_t w = begin / 64; w * 64 < end; w++) {
+            overflows[w] = 0;
+         }
+         //--- mutate gates weight base
+         for (size_t i = begin; i < end; i++) {
+            auto& gate = (*this)[i].gate;
+            if (GateObject::mutate_weight(gate.weight_base, gate.mut_prob_neg, gate.mut_prob_pos, random)) {
+               overflows.set(i, 1);
+            }
          }
-         if (overflowed) {
-            downscale_weights();
+         //--- mutate links weight, only visiting the sampled links
+         size_t mutations_count = 0;
+         for (size_t c = 0; c < this->inputs.size(); c++) {
+            mutations_count += this->inputs[c]->mutate_weights(begin, end, bounds[c], random, overflows);
          }
-      }
-      __declspec(noinline) void downscale_weights() {
-         for (auto& link : links) {
-            auto prev_weight = link.weight;
-            link.weight = round(double(prev_weight) * 0.5);
+         INS_TELEMETRY_COUNT(this->index, Mutations, mutations_count);
+         //--- spread overflows over shared maps, until the maps of every input agree
+         for (bool spread = this->has_shared_weights(); spread;) {
+            spread = false;
+            for (auto* input : this->inputs) {
+               spread |= input->spread_overflows(begin, end, overflows);
+            }
+         }
+         //--- downscale overflowed gates
+         for (size_t w = begin / 64; w * 64 < end; w++) {
+            for (uint64_t bits = overflows[w]; bits; bits &= bits - 1) {
+               downscale_weights(w * 64 + Kernels::count_trailing_zeros(bits));
+            }
          }
-         gate.weight_base = round(double(gate.weight_base) * 0.5);
       }
-      bool mutate_weight(weight_t& weight, Scalar& mut_prob_neg, Scalar& mut_prob_pos) {
-         bool has_overflowed = false;
-         bool has_mut = false;
-         if (mut_prob_neg >= 0 && random_unsigned() < mut_prob_neg) {
-            weight--;
-            has_mut = true;
-            if (weight < WeightMin) has_overflowed = true;
+      void compute_backward(GateContext& context, GateWorkerPool* workers = 0) {
+         if (this->get_links_count() == 0) return;
+         INS_TELEMETRY_TIMER(this->index, Backward);
+         INS_TELEMETRY_COUNT(this->index, Backwards, 1);
+
+         // Inputs which are not a leaf layer receive the links feedback
+         // Shared kernels integrate the feedback of gates of any range, so their layers stay serial
+         auto& state = context.get(this);
+         auto pool = this->has_shared_weights() ? 0 : this->get_workers(workers);
+         size_t inputs_count = this->inputs.size();
+         size_t ranges_count = pool ? pool->get_ranges_count(this->size(), 64) : 0;
+         state.feedback_targets.resize(inputs_count * (ranges_count + 1));
+         state.bounds_buffers.resize(inputs_count * std::max<size_t>(ranges_count, 1));
+         Scalar** feedbacks = state.feedback_targets.data();
+         for (size_t c = 0; c < inputs_count; c++) {
+            auto source = this->inputs[c]->source;
+            feedbacks[c] = source->inputs.empty() ? nullptr : context.get(source).feedback_signals.data();
+         }
+         if (!pool) {
+            this->compute_backward_range(context, 0, this->size(), feedbacks, state.bounds_buffers.data(), context.random);
+            state.summed = false;
+            return;
          }
-         if (mut_prob_pos >= 0 && random_unsigned() < mut_prob_pos) {
-            weight++;
-            has_mut = true;
-            if (weight > WeightMax) has_overflowed = true;
+
+         // Each range dispatches feedback to its own buffers and draws from its own stream,
+         // then buffers are merged in ranges order, so that results only depend on workers count
+         size_t range_size = 0;
+         for (size_t c = 0; c < inputs_count; c++) {
+            if (feedbacks[c]) range_size += this->inputs[c]->source->size();
          }
-         if (has_mut) {
-            mut_prob_neg *= 0.5;
-            mut_prob_pos *= 0.5;
-            mut_prob_pos = clamp<Scalar>(mut_prob_pos, 0, 1);
-            mut_prob_neg = clamp<Scalar>(mut_prob_neg, 0, 1);
+         state.feedback_buffers.assign(range_size * ranges_count, 0);
+         for (size_t r = 0, offset = 0; r < ranges_count; r++) {
+            Scalar** range_feedbacks = &feedbacks[inputs_count * (r + 1)];
+            for (size_t c = 0; c < inputs_count; c++) {
+               range_feedbacks[c] = feedbacks[c] ? &state.feedback_buffers[offset] : nullptr;
+               if (feedbacks[c]) offset += this->inputs[c]->source->size();
+            }
+         }
+         uint64_t seed = context.random.next();
+
+         auto task = [&](size_t begin, size_t end, size_t r) {
+            GateRandom range_random(seed + 0x9e3779b97f4a7c15ull * r);
+            this->compute_backward_range(context, begin, end, &feedbacks[inputs_count * (r + 1)], &state.bounds_buffers[inputs_count * r], range_random);
+         };
+         pool->run_ranges(this->size(), 64, task);
+         state.summed = false;
+
+         for (size_t r = 0; r < ranges_count; r++) {
+            Scalar** range_feedbacks = &feedbacks[inputs_count * (r + 1)];
+            for (size_t c = 0; c < inputs_count; c++) {
+               if (!feedbacks[c]) continue;
+               for (size_t k = 0; k < this->inputs[c]->source->size(); k++) {
+                  feedbacks[c][k] += range_feedbacks[c][k];
+               }
+            }
          }
-         return has_overflowed;
       }
-      static Scalar random_unsigned() {
-         return distribution_unsigned(generator);
+      INS_NOINLINE void downscale_weights(size_t index) {
+         INS_TELEMETRY_COUNT(this->index, Downscales, 1);
+         for (auto* input : this->inputs) {
+            input->downscale_weights(index);
+         }
+         GateObject::downscale_weight_shared((*this)[index].gate.weight_base);
       }
-      static Scalar random_signed() {
-         return distribution_signed(generator);
+      bool get_state(const GateContext& context, int state_index) const {
+         return context.layers[this->index].states.get(state_index);
+      }
+      GateObject& get(int state_index) {
+         return (*this)[state_index];
       }
    };
 
-   struct GateLayer : std::vector<GateObject> {
-      int level = 0;
-      GateLayer(int count, int level)
-         : vector(count), level(level) {
+   inline GateLayerState& GateContext::get(const GateLayer* layer) {
+      return this->layers[layer->index];
+   }
+
+   struct GateObjectModel {
+      GateArena arena; // storage of a model built from a shape, empty otherwise
+      std::pmr::memory_resource* resource; // storage of layers, connections and default context
+      std::pmr::vector<GateLayer*> layers;
+      std::pmr::vector<GateConnection*> connections;
+      GateRandom random; // model stream, drawn for initialization and split for contexts
+      GateContext context; // default context of the single threaded api
+      GateWorkerPool* workers = 0; // optional pool to split wide layers compute of the default context
+
+      GateObjectModel(uint64_t seed = GateRandom::DefaultSeed)
+         : resource(std::pmr::get_default_resource()), layers(resource), connections(resource), random(seed), context(resource) {
+      }
+      // Dense model of 'shape': layer i is fully linked to layer i - 1. The whole model and its
+      // default context are laid out in one arena, so building is a single allocation, as is teardown.
+      GateObjectModel(const Shapes::DenseShape& shape, uint64_t seed = GateRandom::DefaultSeed)
+         : arena(get_arena_size(shape)), resource(&arena), layers(resource), connections(resource), random(seed), context(resource) {
+         this->layers.reserve(shape.height);
+         this->connections.reserve(shape.height ? shape.height - 1 : 0);
+         for (uint32_t i = 0; i < shape.height; i++) {
+            auto layer = this->add_layer(shape.get_layer_width(i), i);
+            if (i > 0) this->connect_layer(this->layers[i - 1], layer);
+         }
+         this->initialize();
       }
-      void emit_feeback(std::vector<Scalar> feedbacks) {
-         if (feedbacks.size() != this->size()) throw;
+      ~GateObjectModel() {
+         for (auto* connection : this->connections) this->destroy(connection);
+         for (auto* layer : this->layers) this->destroy(layer);
+      }
+      GateObjectModel(const GateObjectModel&) = delete;
+      GateObjectModel& operator=(const GateObjectModel&) = delete;
 
-         int index = 0;
-         for (auto& gate : (*this)) {
-            gate.emit_feeback(feedbacks[index]);
-            index++;
+      // Arena bytes of a dense model and its default context, once trained serially
+      static size_t get_arena_size(const Shapes::DenseShape& shape) {
+         auto slab = [](size_t bytes) { return bytes ? GateArena::get_slab_size(bytes) : 0; };
+         size_t size = slab(shape.height * sizeof(GateLayer*)) + slab((shape.height ? shape.height - 1 : 0) * sizeof(GateConnection*));
+         size += slab(shape.height * sizeof(GateLayerState));
+         for (uint32_t i = 0; i < shape.height; i++) {
+            size_t width = shape.get_layer_width(i);
+            size_t words = (width + 63) / 64;
+            size += slab(sizeof(GateLayer)) + slab(width * sizeof(GateObject));
+            size += 3 * slab(words * sizeof(uint64_t)) + 2 * slab(width * sizeof(GateObject::weight_sum_t));
+            size += slab(width * sizeof(Scalar)) + slab(width * sizeof(uint64_t));
+            if (i > 0) {
+               size_t links_count = width * shape.get_layer_width(i - 1);
+               size += slab(sizeof(GateLayer*)) + slab(sizeof(GateConnection));
+               size += slab(links_count * sizeof(GateObject::weight_t)) + 2 * slab(links_count * sizeof(GateObject::mut_prob_t));
+               size += slab(sizeof(Scalar*)) + slab(sizeof(GateMutation::Bounds));
+            }
          }
+         return size;
       }
-      void write_vec8(std::vector<uint8_t> values) {
-         if (values.size() * 8 != this->size()) throw;
 
-         int index = 0;
-         for (auto& gate : (*this)) {
-            uint8_t mask = 1 << (index % 8);
-            gate.state = values[index / 8] & mask;
-            index++;
+      GateLayer* add_layer(int count, int level) {
+         auto layer = this->create<GateLayer>(count, level, this->resource);
+         this->layers.push_back(layer);
+         return layer;
+      }
+      // Connect every gate of 'from_layer' to every gate of 'to_layer'
+      // As in the original per-gate links, a layer may take any number of inputs, including several
+      // connections from the same source layer: their sums add up, as duplicated links did.
+      GateConnection* connect_layer(GateLayer* from_layer, GateLayer* to_layer) {
+         return this->connect_layer(from_layer, to_layer, GateLinks::dense(from_layer->size()));
+      }
+      // Connect following a links pattern, eg. GateLinks::local(28, 28, 5) from an image layer
+      // The source may be any layer of a lower level, which makes skip connections across levels.
+      // Random patterns draw their source gates from the model stream.
+      GateConnection* connect_layer(GateLayer* from_layer, GateLayer* to_layer, const GateLinks& links) {
+         if (from_layer->level >= to_layer->level) throw std::invalid_argument("GateObjectModel::connect_layer: source level shall be below target level");
+         if (!links.is_valid(from_layer->size(), to_layer->size())) throw std::invalid_argument("GateObjectModel::connect_layer: links do not fit the layers sizes");
+
+         auto connection = this->create<GateConnection>(from_layer, to_layer, links, to_layer->size(), this->resource);
+         links.draw_indices(connection->indices.data(), connection->height, this->random);
+         this->connections.push_back(connection);
+         to_layer->inputs.push_back(connection);
+         return connection;
+      }
+      // Add a layer of 'maps' feature maps, each sliding one window x window kernel over a rows x cols image layer
+      GateLayer* add_convolution_layer(GateLayer* image, size_t rows, size_t cols, size_t maps, size_t window, size_t stride, int level) {
+         auto links = GateLinks::convolution(rows, cols, window, stride);
+         size_t positions = window && stride && window <= rows && window <= cols ? links.get_positions_count() : 0;
+         if (!links.is_valid(image->size(), maps * positions)) throw std::invalid_argument("GateObjectModel::add_convolution_layer: kernel does not fit the image layer");
+
+         auto layer = this->add_layer(int(maps * positions), level);
+         this->connect_layer(image, layer, links);
+         return layer;
+      }
+      void set_workers(GateWorkerPool* workers) {
+         this->workers = workers;
+      }
+      // Order layers by level, layers of a same level keep their insertion order
+      void sort_layers() {
+         std::stable_sort(this->layers.begin(), this->layers.end(), [](const GateLayer* a, const GateLayer* b) {
+            return a->level < b->level;
+            });
+         for (size_t i = 0; i < this->layers.size(); i++) {
+            this->layers[i]->index = i;
          }
       }
       void initialize() {
-         for (auto& gate : (*this)) {
-            gate.initialize();
+         this->sort_layers();
+         for (size_t i = 0; i < this->layers.size(); i++) {
+            auto layer = this->layers[i];
+            for (auto* input : layer->inputs) {
+               input->initialize(this->random);
+            }
+            layer->initialize(this->random);
          }
+         this->initialize_context(this->context, this->random.split());
       }
-      void compute_forward() {
-         for (auto& gate : (*this)) {
-            gate.compute_forward();
+      // Size 'context' for this model, drawing mutations from 'random'
+      void initialize_context(GateContext& context, const GateRandom& random) const {
+         context.random = random;
+         context.accumulated = false;
+         context.layers.clear();
+         context.layers.reserve(this->layers.size());
+         for (auto* layer : this->layers) {
+            context.layers.emplace_back(layer->size());
          }
       }
-      void compute_backward() {
-         for (auto& gate : (*this)) {
-            gate.compute_backward();
-         }
+      // Create a context for another thread, drawing mutations from 'random'
+      GateContext create_context(const GateRandom& random) const {
+         GateContext context;
+         this->initialize_context(context, random);
+         return context;
       }
-      GateObject& get(int state_index) {
-         return (*this)[state_index];
+      // The pool has a single caller at a time, so it only serves the default context
+      GateWorkerPool* get_workers(const GateContext& context) const {
+         return &context == &this->context ? this->workers : 0;
       }
-   };
-
-   struct GateObjectModel {
-      std::vector<std::unique_ptr<GateLayer>> layers;
-      GateLayer* add_layer(int count, int level) {
-         auto layer = new GateLayer(count, level);
-         this->layers.push_back(std::unique_ptr<GateLayer>(layer));
-         return layer;
+      void compute_forward(GateContext& context) {
+         auto workers = this->get_workers(context);
+         for (size_t i = 0; i < this->layers.size(); i++) {
+            auto layer = this->layers[i];
+            layer->compute_forward(context, workers);
+         }
+         this->clear_changes(context);
+         context.accumulated = true;
       }
-      void connect_layer(GateLayer* from_layer, GateLayer* to_layer) {
-         if (from_layer->level >= to_layer->level) throw;
-
-         for (auto& from_gate : *from_layer) {
-            for (auto& to_gate : *to_layer) {
-               to_gate.links.push_back(from_gate);
-            }
+      // Incremental forward, propagating only the gates flipped since the last forward of the context:
+      // its cost follows the changed links instead of all links, which suits sweeps and correlated samples.
+      // Accumulators are resynced by a full forward after a backward of the context. When other threads
+      // train the model, the caller shall resync them with compute_forward.
+      void compute_forward_delta(GateContext& context) {
+         if (!context.accumulated) {
+            this->compute_forward(context);
+            return;
          }
+         for (size_t i = 0; i < this->layers.size(); i++) {
+            auto layer = this->layers[i];
+            layer->compute_forward_delta(context);
+         }
+         this->clear_changes(context);
       }
-      void initialize() {
-         std::sort(this->layers.begin(), this->layers.end(), [](const std::unique_ptr<GateLayer>& a, const std::unique_ptr<GateLayer>& b) {
-            return a->level < b->level;
-            });
-         for (int i = 0; i < this->layers.size(); i++) {
-            auto layer = this->layers[i].get();
-            layer->initialize();
+      template <class T, class... Args>
+      T* create(Args&&... args) {
+         return new (this->resource->allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+      }
+      template <class T>
+      void destroy(T* object) {
+         object->~T();
+         this->resource->deallocate(object, sizeof(T), alignof(T));
+      }
+      void clear_changes(GateContext& context) {
+         for (auto& state : context.layers) {
+            std::fill(state.changes.begin(), state.changes.end(), 0);
          }
       }
-      void compute_forward() {
-         for (int i = 0; i < this->layers.size(); i++) {
-            auto layer = this->layers[i].get();
-            layer->compute_forward();
+      void compute_forward_batch(GateContext& context) {
+         for (size_t i = 0; i < this->layers.size(); i++) {
+            auto layer = this->layers[i];
+            layer->compute_forward_batch(context);
          }
       }
-      void compute_backward() {
+      // Feedback is integrated with the links weights sums of the last full forward of the context, which
+      // match the current weights unless other threads mutated them meanwhile, as for the accumulators.
+      void compute_backward(GateContext& context) {
+         auto workers = this->get_workers(context);
+         context.accumulated = false;
          for (int i = this->layers.size() - 1; i >= 0; i--) {
-            auto layer = this->layers[i].get();
-            layer->compute_backward();
+            auto layer = this->layers[i];
+            layer->compute_backward(context, workers);
          }
       }
+      void compute_forward() {
+         this->compute_forward(this->context);
+      }
+      void compute_forward_delta() {
+         this->compute_forward_delta(this->context);
+      }
+      void compute_forward_batch() {
+         this->compute_forward_batch(this->context);
+      }
+      void compute_backward() {
+         this->compute_backward(this->context);
+      }
    };
 
    namespace Models {
-      struct SingleGateImage2DModel : IImage2DTrainable {
+
+      // Image model reading pixel (i, j) as 16 input gates, and answering with a single output gate
+      // The context overloads let several threads evaluate and train the same model.
+      struct GateImage2DModel : IImage2DTrainable {
          GateObjectModel model;
          GateLayer& inputs;
          GateLayer& outputs;
-         SingleGateImage2DModel() :
+         GateImage2DModel(uint64_t seed, int outputs_level) :
+            model(seed),
             inputs(*model.add_layer(16, 0)),
-            outputs(*model.add_layer(1, 1))
+            outputs(*model.add_layer(1, outputs_level))
          {
-            model.connect_layer(&inputs, &outputs);
-            model.initialize();
          }
-         bool estimate_pixel(uint8_t i, uint8_t j) override {
-            inputs.write_vec8({ i, j });
-            model.compute_forward();
-            return outputs[0].state;
+         bool estimate_pixel(GateContext& context, uint8_t i, uint8_t j) {
+            inputs.write_vec8(context, { i, j });
+            model.compute_forward_delta(context);
+            return outputs.get_state(context, 0);
          }
-         bool train_pixel(uint8_t i, uint8_t j, bool expected) override {
-            inputs.write_vec8({ i, j });
-            model.compute_forward();
-            auto r = outputs[0].state;
+         bool train_pixel(GateContext& context, uint8_t i, uint8_t j, bool expected) {
+            inputs.write_vec8(context, { i, j });
+            model.compute_forward(context);
+            auto r = outputs.get_state(context, 0);
 
             Scalar feedback = (r == expected) ? 1.0f : -1.0f;
-            outputs.emit_feeback({ feedback });
-            model.compute_backward();
+            outputs.emit_feeback(context, { feedback });
+            model.compute_backward(context);
 
-            return outputs[0].state;
+            return outputs.get_state(context, 0);
+         }
+         bool estimate_pixel(uint8_t i, uint8_t j) override {
+            return this->estimate_pixel(model.context, i, j);
+         }
+         uint64_t estimate_pixels(const uint8_t(*pixels)[2], int count) override {
+            inputs.write_vec8_batch(model.context, pixels[0], 2, count);
+            model.compute_forward_batch();
+            return model.context.get(&outputs).batch_states[0] & Kernels::word_mask(0, count);
+         }
+         bool train_pixel(uint8_t i, uint8_t j, bool expected) override {
+            return this->train_pixel(model.context, i, j, expected);
          }
       };
-      struct HiddenLayerImage2DModel : IImage2DTrainable {
-         GateObjectModel model;
-         GateLayer& inputs;
-         GateLayer& outputs;
-         HiddenLayerImage2DModel() :
-            inputs(*model.add_layer(16, 0)),
-            outputs(*model.add_layer(1, 2))
-         {
+      struct SingleGateImage2DModel : GateImage2DModel {
+         SingleGateImage2DModel(uint64_t seed = GateRandom::DefaultSeed)
+            : GateImage2DModel(seed, 1) {
+            model.connect_layer(&inputs, &outputs);
+            model.initialize();
+         }
+      };
+      struct HiddenLayerImage2DModel : GateImage2DModel {
+         HiddenLayerImage2DModel(uint64_t seed = GateRandom::DefaultSeed)
+            : GateImage2DModel(seed, 2) {
             auto hidden_layer = model.add_layer(4, 1);
             model.connect_layer(&inputs, hidden_layer);
             model.connect_layer(hidden_layer, &outputs);
             model.initialize();
          }
-         bool estimate_pixel(uint8_t i, uint8_t j) override {
-            inputs.write_vec8({ i, j });
-            model.compute_forward();
-            return outputs[0].state;
-         }
-         bool train_pixel(uint8_t i, uint8_t j, bool expected) override {
-            inputs.write_vec8({ i, j });
-            model.compute_forward();
-            auto r = outputs[0].state;
-
-            Scalar feedback = (r == expected) ? 1.0f : -1.0f;
-            outputs.emit_feeback({ feedback });
-            model.compute_backward();
-
-            return outputs[0].state;
-         }
       };
    }
 }
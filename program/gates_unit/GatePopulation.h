@@ -0,0 +1,370 @@
+#pragma once
+
+#include "./GateStatic.h"
+#include "./GateWorkers.h"
+#include <stdio.h>
+#include <algorithm>
+#include <vector>
+
+namespace ins {
+
+   // Lanes models of a same static topology, trained side by side on the same samples
+   // Parameters are interleaved (weight k of lane m is weights[k * Lanes + m]) and a gate state is the mask
+   // of its lanes, so each sweep over links updates all models through contiguous lanes loops.
+   // Lane m draws from its own stream in the StaticGateNetwork order: it trains exactly as a
+   // StaticGateNetwork of the same seed, fed the same samples and feedback.
+   template <size_t... Widths>
+   struct GatePopulationBlock {
+      typedef StaticGateNetwork<Widths...> network_t;
+      typedef GateObject::weight_t weight_t;
+      typedef GateObject::mut_prob_t mut_prob_t;
+      typedef int32_t lane_sum_t; // weights sum of a gate, bounded as weights stay within WeightMax + 1
+      typedef uint32_t lanes_t; // bit m is lane m
+
+      static constexpr size_t Lanes = 16;
+      static constexpr lanes_t AllLanes = lanes_t((uint64_t(1) << Lanes) - 1);
+      static constexpr size_t LayersCount = network_t::LayersCount;
+      static constexpr size_t InputsCount = network_t::widths[0];
+      static constexpr size_t GatesCount = network_t::GatesCount;
+      static constexpr size_t LinksCount = network_t::LinksCount;
+      static constexpr size_t MaxWidth = std::max({ Widths... });
+      static_assert((MaxWidth + 1) * (size_t(GateObject::WeightMax) + 1) <= size_t(INT32_MAX), "gates weights sums shall fit lane_sum_t");
+
+      // Offset of layer l in states, input gates first
+      static constexpr size_t get_states_offset(size_t l) {
+         return l ? InputsCount + network_t::get_gates_offset(l) : 0;
+      }
+
+      alignas(64) weight_t weights[LinksCount * Lanes];
+      alignas(64) mut_prob_t mut_prob_neg[LinksCount * Lanes];
+      alignas(64) mut_prob_t mut_prob_pos[LinksCount * Lanes];
+      alignas(64) weight_t weight_base[GatesCount * Lanes];
+      alignas(64) mut_prob_t gate_prob_neg[GatesCount * Lanes];
+      alignas(64) mut_prob_t gate_prob_pos[GatesCount * Lanes];
+      alignas(64) Scalar feedback_signals[GatesCount * Lanes];
+      lanes_t states[InputsCount + GatesCount];
+      GateRandom random[Lanes];
+
+      GatePopulationBlock() {
+         std::fill(std::begin(weights), std::end(weights), 0);
+         std::fill(std::begin(mut_prob_neg), std::end(mut_prob_neg), 0);
+         std::fill(std::begin(mut_prob_pos), std::end(mut_prob_pos), 0);
+         std::fill(std::begin(weight_base), std::end(weight_base), 0);
+         std::fill(std::begin(gate_prob_neg), std::end(gate_prob_neg), 0);
+         std::fill(std::begin(gate_prob_pos), std::end(gate_prob_pos), 0);
+         std::fill(std::begin(feedback_signals), std::end(feedback_signals), 0);
+         std::fill(std::begin(states), std::end(states), 0);
+      }
+
+      // Initialize lane m as StaticGateNetwork(seed)
+      void initialize_lane(size_t m, uint64_t seed) {
+         auto& lane_random = random[m] = GateRandom(seed);
+         for (size_t i = 0; i < InputsCount; i++) lane_random.uniform_signed();
+         for (size_t l = 1; l < LayersCount; l++) {
+            size_t links_offset = network_t::get_links_offset(l);
+            size_t gates_offset = network_t::get_gates_offset(l);
+            for (size_t k = 0; k < network_t::widths[l] * network_t::widths[l - 1]; k++) {
+               weights[(links_offset + k) * Lanes + m] = lane_random.uniform_signed() * GateObject::WeightInit;
+            }
+            for (size_t i = 0; i < network_t::widths[l]; i++) {
+               GateObject object;
+               object.initialize(lane_random);
+               weight_base[(gates_offset + i) * Lanes + m] = object.gate.weight_base;
+            }
+         }
+      }
+
+      // Write the same input sample to all lanes, bit k of word w is input gate w * 64 + k
+      void write_inputs(const uint64_t* words) {
+         for (size_t k = 0; k < InputsCount; k++) {
+            states[k] = ((words[k >> 6] >> (k & 63)) & 1) ? AllLanes : 0;
+         }
+      }
+      lanes_t get_outputs(size_t index) const {
+         return states[get_states_offset(LayersCount - 1) + index];
+      }
+      void emit_feedback(size_t index, size_t m, Scalar feedback) {
+         feedback_signals[(network_t::get_gates_offset(LayersCount - 1) + index) * Lanes + m] += feedback;
+      }
+
+      void compute_forward() {
+         for (size_t l = 1; l < LayersCount; l++) this->compute_forward_layer(l);
+      }
+      void compute_backward() {
+         for (size_t l = LayersCount - 1; l > 0; l--) this->compute_backward_layer(l);
+      }
+
+   private:
+      // Lanes of source gate k as all-ones or zero weights, at input_masks[k * Lanes + m]
+      void get_input_masks(const lanes_t* inputs, size_t width, weight_t* input_masks) const {
+         for (size_t k = 0; k < width; k++) {
+            for (size_t m = 0; m < Lanes; m++) input_masks[k * Lanes + m] = -weight_t((inputs[k] >> m) & 1);
+         }
+      }
+
+      void compute_forward_layer(size_t l) {
+         size_t width = network_t::widths[l - 1];
+         size_t height = network_t::widths[l];
+         const weight_t* layer_weights = &weights[network_t::get_links_offset(l) * Lanes];
+         const weight_t* layer_base = &weight_base[network_t::get_gates_offset(l) * Lanes];
+         lanes_t* outputs = &states[get_states_offset(l)];
+
+         alignas(64) weight_t input_masks[MaxWidth * Lanes];
+         this->get_input_masks(&states[get_states_offset(l - 1)], width, input_masks);
+         for (size_t i = 0; i < height; i++) {
+            lane_sum_t acc[Lanes];
+            for (size_t m = 0; m < Lanes; m++) acc[m] = layer_base[i * Lanes + m];
+            const weight_t* row = &layer_weights[i * width * Lanes];
+            for (size_t k = 0; k < width; k++) {
+               for (size_t m = 0; m < Lanes; m++) acc[m] += row[k * Lanes + m] & input_masks[k * Lanes + m];
+            }
+            lanes_t output = 0;
+            for (size_t m = 0; m < Lanes; m++) output |= lanes_t(acc[m] > 0) << m;
+            outputs[i] = output;
+         }
+      }
+
+      static mut_prob_t damp(mut_prob_t prob) {
+         return GateObject::Feedback::reward_damping == 0 ? 0 : GateMutation::scale(prob, GateObject::Feedback::reward_damping);
+      }
+
+      void compute_backward_layer(size_t l) {
+         size_t width = network_t::widths[l - 1];
+         size_t height = network_t::widths[l];
+         size_t links_offset = network_t::get_links_offset(l) * Lanes;
+         size_t gates_offset = network_t::get_gates_offset(l);
+         const lanes_t* outputs = &states[get_states_offset(l)];
+
+         // Feedback to the input layer is dropped into scratch
+         alignas(64) Scalar dropped_signals[MaxWidth * Lanes] = {};
+         Scalar* input_signals = l > 1 ? &feedback_signals[network_t::get_gates_offset(l - 1) * Lanes] : dropped_signals;
+
+         alignas(64) weight_t input_masks[MaxWidth * Lanes];
+         this->get_input_masks(&states[get_states_offset(l - 1)], width, input_masks);
+
+         // Integrate feedback to stats, as GateObject::Feedback::integrate_link over the lanes of each link
+         mut_prob_t bounds_neg[Lanes] = {}, bounds_pos[Lanes] = {};
+         for (size_t i = 0; i < height; i++) {
+            size_t g = (gates_offset + i) * Lanes;
+            weight_t* row_weights = &weights[links_offset + i * width * Lanes];
+            mut_prob_t* row_mut_prob_neg = &mut_prob_neg[links_offset + i * width * Lanes];
+            mut_prob_t* row_mut_prob_pos = &mut_prob_pos[links_offset + i * width * Lanes];
+
+            lane_sum_t links_weights_sum[Lanes];
+            for (size_t m = 0; m < Lanes; m++) links_weights_sum[m] = weight_base[g + m];
+            for (size_t k = 0; k < width; k++) {
+               for (size_t m = 0; m < Lanes; m++) links_weights_sum[m] += abs(row_weights[k * Lanes + m]) & input_masks[k * Lanes + m];
+            }
+
+            // Per lane feedback params, and lanes masks of its branches
+            Scalar signal[Lanes], factor[Lanes], offset[Lanes];
+            mut_prob_t prob[Lanes], reward_prob[Lanes], gate_neg[Lanes], gate_pos[Lanes];
+            uint32_t reward[Lanes], state[Lanes];
+            for (size_t m = 0; m < Lanes; m++) {
+               GateObject object;
+               object.gate.weight_base = weight_base[g + m];
+               object.gate.mut_prob_neg = gate_prob_neg[g + m];
+               object.gate.mut_prob_pos = gate_prob_pos[g + m];
+               bool output = (outputs[i] >> m) & 1;
+               auto feedback = object.integrate_feedback(feedback_signals[g + m], output, links_weights_sum[m], width);
+               feedback_signals[g + m] = 0;
+               gate_neg[m] = object.gate.mut_prob_neg;
+               gate_pos[m] = object.gate.mut_prob_pos;
+               signal[m] = feedback.signal;
+               prob[m] = feedback.prob;
+               factor[m] = feedback.factor;
+               offset[m] = feedback.offset;
+               reward_prob[m] = damp(feedback.prob);
+               reward[m] = feedback.signal > 0 ? ~0u : 0;
+               state[m] = output ? ~0u : 0;
+            }
+
+            // Branches are lanes masks, so that the lanes loop vectorizes
+            for (size_t k = 0; k < width; k++) {
+               for (size_t m = 0; m < Lanes; m++) {
+                  size_t link = k * Lanes + m;
+                  uint32_t input = uint32_t(int32_t(input_masks[link]));
+                  int32_t weight = row_weights[link];
+                  mut_prob_t neg = row_mut_prob_neg[link];
+                  mut_prob_t pos = row_mut_prob_pos[link];
+
+                  int32_t lweight = (abs(weight) & reward[m]) | (weight & ~reward[m]);
+                  Scalar loffset = offset[m] * Scalar(int32_t((reward[m] | input) & 2) - 1);
+                  input_signals[link] += loffset + signal[m] * Scalar(lweight) * factor[m];
+
+                  // Punished links move toward flipping the gate, unused links of rewarded gates are damped
+                  uint32_t punish_pos = ~reward[m] & (input ^ state[m]);
+                  uint32_t punish_neg = ~reward[m] & ~(input ^ state[m]);
+                  uint32_t damped = reward[m] & ~input;
+                  if constexpr (GateObject::Feedback::reward_damping == 0) {
+                     neg &= ~damped;
+                     pos &= ~damped;
+                  }
+                  else {
+                     neg = damped ? damp(neg) : neg;
+                     pos = damped ? damp(pos) : pos;
+                  }
+                  neg = GateMutation::clamp_one(GateMutation::add(neg, prob[m] & punish_neg));
+                  pos = GateMutation::clamp_one(GateMutation::add(pos, prob[m] & punish_pos));
+                  gate_neg[m] = GateMutation::sub(gate_neg[m], reward_prob[m] & reward[m] & input);
+                  gate_pos[m] = GateMutation::sub(gate_pos[m], reward_prob[m] & reward[m] & input);
+                  row_mut_prob_neg[link] = neg;
+                  row_mut_prob_pos[link] = pos;
+                  bounds_neg[m] = std::max(bounds_neg[m], neg);
+                  bounds_pos[m] = std::max(bounds_pos[m], pos);
+               }
+            }
+            for (size_t m = 0; m < Lanes; m++) {
+               gate_prob_neg[g + m] = gate_neg[m];
+               gate_prob_pos[g + m] = gate_pos[m];
+            }
+         }
+
+         // Mutate weights, and downscale overflowed gates, lane by lane from each lane stream
+         for (size_t m = 0; m < Lanes; m++) {
+            uint64_t overflows[(MaxWidth + 63) / 64] = {};
+            for (size_t i = 0; i < height; i++) {
+               size_t g = (gates_offset + i) * Lanes + m;
+               if (GateObject::mutate_weight(weight_base[g], gate_prob_neg[g], gate_prob_pos[g], random[m])) {
+                  overflows[i >> 6] |= uint64_t(1) << (i & 63);
+               }
+            }
+            GateMutation::mutate_array(&weights[links_offset + m], &mut_prob_neg[links_offset + m], &mut_prob_pos[links_offset + m], width * height, Lanes,
+               bounds_neg[m], bounds_pos[m], GateObject::WeightMin, GateObject::WeightMax,
+               random[m], [&](size_t k) { overflows[(k / width) >> 6] |= uint64_t(1) << ((k / width) & 63); });
+            for (size_t i = 0; i < height; i++) {
+               if (!((overflows[i >> 6] >> (i & 63)) & 1)) continue;
+               weight_t* row_weights = &weights[links_offset + i * width * Lanes + m];
+               for (size_t k = 0; k < width; k++) {
+                  row_weights[k * Lanes] = GateObject::downscale_weight(row_weights[k * Lanes]);
+               }
+               size_t g = (gates_offset + i) * Lanes + m;
+               weight_base[g] = GateObject::downscale_weight(weight_base[g]);
+            }
+         }
+      }
+   };
+
+   // Population of image models of a same topology, each with its own seed, reference image and feedback scale
+   // Models are packed by Lanes into blocks, and blocks are trained in parallel over the workers,
+   // each on its own stream of pixels. Results only depend on the members, not on the workers count.
+   template <size_t... Widths>
+   struct GateImage2DPopulation {
+      typedef GatePopulationBlock<16, Widths...> block_t;
+      typedef typename block_t::lanes_t lanes_t;
+      static constexpr size_t Lanes = block_t::Lanes;
+      static constexpr size_t PixelsCount = 32 * 32;
+
+      struct Member {
+         const char* name = "";
+         uint64_t seed = GateRandom::DefaultSeed;
+         Scalar feedback = 1; // magnitude of the output feedback
+         Image2DBits target;
+      };
+      struct Entry {
+         size_t index;
+         size_t matches; // pixels of 32x32 matching the target
+      };
+
+      std::vector<Member> members;
+      std::vector<block_t> blocks;
+      std::vector<GateRandom> streams; // pixels stream of each block
+      std::vector<lanes_t> targets; // per block and pixel i * 32 + j, the lanes whose target pixel is set
+      GateWorkerPool* workers = 0;
+
+      size_t size() const {
+         return members.size();
+      }
+
+      // Add a model trained toward 'target', and return its index
+      size_t add(const char* name, IImage2DModel& target, uint64_t seed = GateRandom::DefaultSeed, Scalar feedback = 1) {
+         size_t index = members.size();
+         size_t m = index % Lanes;
+         if (m == 0) {
+            blocks.emplace_back();
+            streams.emplace_back(GateRandom::DefaultSeed + 0x9e3779b97f4a7c15ull * blocks.size());
+            targets.resize(blocks.size() * PixelsCount, 0);
+         }
+         Member member;
+         member.name = name;
+         member.seed = seed;
+         member.feedback = feedback;
+         target.estimate_image(member.target);
+         members.push_back(member);
+
+         blocks.back().initialize_lane(m, seed);
+         lanes_t* block_targets = &targets[(blocks.size() - 1) * PixelsCount];
+         for (size_t p = 0; p < PixelsCount; p++) {
+            block_targets[p] |= lanes_t(member.target.get(int(p / 32), int(p % 32))) << m;
+         }
+         return index;
+      }
+
+      // Train every model on 'samples_count' pixels, drawn per block
+      void train(size_t samples_count) {
+         auto task = [&](size_t b) {
+            auto& block = blocks[b];
+            auto& random = streams[b];
+            const lanes_t* block_targets = &targets[b * PixelsCount];
+            size_t members_count = std::min(Lanes, members.size() - b * Lanes);
+            for (size_t s = 0; s < samples_count; s++) {
+               uint64_t i = random.next_u32() % 32, j = random.next_u32() % 32;
+               uint64_t inputs = i | (j << 8);
+               block.write_inputs(&inputs);
+               block.compute_forward();
+               lanes_t correct = ~(block.get_outputs(0) ^ block_targets[i * 32 + j]);
+               for (size_t m = 0; m < members_count; m++) {
+                  Scalar feedback = members[b * Lanes + m].feedback;
+                  block.emit_feedback(0, m, ((correct >> m) & 1) ? feedback : -feedback);
+               }
+               block.compute_backward();
+            }
+         };
+         if (workers) workers->run(blocks.size(), task);
+         else for (size_t b = 0; b < blocks.size(); b++) task(b);
+      }
+
+      // Pixels of each model matching its target, over the whole image
+      std::vector<size_t> evaluate() {
+         std::vector<size_t> matches(members.size(), 0);
+         for (size_t b = 0; b < blocks.size(); b++) {
+            auto& block = blocks[b];
+            const lanes_t* block_targets = &targets[b * PixelsCount];
+            size_t members_count = std::min(Lanes, members.size() - b * Lanes);
+            for (uint64_t p = 0; p < PixelsCount; p++) {
+               uint64_t inputs = (p / 32) | ((p % 32) << 8);
+               block.write_inputs(&inputs);
+               block.compute_forward();
+               lanes_t correct = ~(block.get_outputs(0) ^ block_targets[p]);
+               for (size_t m = 0; m < members_count; m++) matches[b * Lanes + m] += (correct >> m) & 1;
+            }
+         }
+         return matches;
+      }
+
+      // Models by decreasing matches, ties in members order
+      std::vector<Entry> get_leaderboard() {
+         auto matches = this->evaluate();
+         std::vector<Entry> entries;
+         for (size_t k = 0; k < matches.size(); k++) entries.push_back({ k, matches[k] });
+         std::stable_sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+            return a.matches > b.matches;
+            });
+         return entries;
+      }
+      void write_leaderboard(FILE* file, size_t count = 10) {
+         auto entries = this->get_leaderboard();
+         fprintf(file, "rank,model,target,seed,feedback,accuracy\n");
+         for (size_t r = 0; r < std::min(count, entries.size()); r++) {
+            auto& member = members[entries[r].index];
+            fprintf(file, "%zu,%zu,%s,%llu,%.3f,%.4f\n", r + 1, entries[r].index, member.name,
+               (unsigned long long)member.seed, double(member.feedback), double(entries[r].matches) / double(PixelsCount));
+         }
+      }
+   };
+
+   namespace Models {
+      typedef GateImage2DPopulation<1> SingleGateImage2DPopulation;
+      typedef GateImage2DPopulation<4, 1> HiddenLayerImage2DPopulation;
+   }
+}
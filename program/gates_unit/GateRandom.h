@@ -0,0 +1,108 @@
+#pragma once
+
+#include "../math.h"
+#include "./GateKernels.h"
+#include <atomic>
+
+namespace ins {
+
+   // xoshiro256** pseudo random generator, seeded through splitmix64
+   // A generator is not thread safe: each thread draws from its own stream
+   struct GateRandom {
+      static constexpr uint64_t DefaultSeed = 0x853c49e6748fea9bull;
+
+      uint64_t s[4];
+
+      explicit GateRandom(uint64_t seed = DefaultSeed) {
+         this->seed(seed);
+      }
+      void seed(uint64_t seed) {
+         for (auto& x : s) {
+            seed += 0x9e3779b97f4a7c15ull;
+            uint64_t z = seed;
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+            x = z ^ (z >> 31);
+         }
+      }
+      static uint64_t rotl(uint64_t x, int k) {
+         return (x << k) | (x >> (64 - k));
+      }
+      uint64_t next() {
+         uint64_t result = rotl(s[1] * 5, 7) * 9;
+         uint64_t t = s[1] << 17;
+         s[2] ^= s[0];
+         s[3] ^= s[1];
+         s[1] ^= s[2];
+         s[0] ^= s[3];
+         s[2] ^= t;
+         s[3] = rotl(s[3], 45);
+         return result;
+      }
+      uint32_t next_u32() {
+         return uint32_t(next() >> 32);
+      }
+
+      // Uniform in [0, 1), with the 24 bits precision of Scalar
+      Scalar uniform() {
+         return Scalar(next() >> 40) * (1.0f / 16777216.0f);
+      }
+      // Uniform in [-1, 1)
+      Scalar uniform_signed() {
+         return Scalar(int64_t(next() >> 39) - (int64_t(1) << 24)) * (1.0f / 16777216.0f);
+      }
+      void fill_uniform(Scalar* values, size_t count) {
+         for (size_t i = 0; i < count; i++) {
+            values[i] = uniform();
+         }
+      }
+
+      // 64 independent Bernoulli bits of probability 'prob', with 24 bits precision
+      // Each bit of the probability, from the lowest, combines a fresh random word:
+      // 'or' for a one, 'and' for a zero.
+      uint64_t bernoulli_bits(Scalar prob) {
+         if (prob <= 0) return 0;
+         if (prob >= 1) return ~uint64_t(0);
+         uint32_t threshold = uint32_t(prob * 16777216.0f);
+         if (!threshold) return 0;
+         uint64_t bits = 0;
+         for (uint32_t t = threshold >> Kernels::count_trailing_zeros(threshold), n = 24 - Kernels::count_trailing_zeros(threshold); n; t >>= 1, n--) {
+            bits = (t & 1) ? (bits | next()) : (bits & next());
+         }
+         return bits;
+      }
+      void fill_bernoulli(uint64_t* words, size_t count, Scalar prob) {
+         for (size_t i = 0; i < count; i++) {
+            words[i] = bernoulli_bits(prob);
+         }
+      }
+
+      // Advance by 2^128 draws, used to derive non-overlapping parallel streams
+      void jump() {
+         static const uint64_t JUMP[] = { 0x180ec6d33cfd0aba, 0xd5a61266f0c9392c, 0xa9582618e03fc9aa, 0x39abdc4529b1661c };
+         uint64_t t[4] = { 0, 0, 0, 0 };
+         for (int i = 0; i < 4; i++) {
+            for (int b = 0; b < 64; b++) {
+               if (JUMP[i] & (uint64_t(1) << b)) {
+                  for (int k = 0; k < 4; k++) t[k] ^= s[k];
+               }
+               next();
+            }
+         }
+         for (int k = 0; k < 4; k++) s[k] = t[k];
+      }
+      // Return a generator on the current stream, and jump this one to the next stream
+      GateRandom split() {
+         GateRandom stream = *this;
+         this->jump();
+         return stream;
+      }
+
+      // Generator of the calling thread, for draws outside any model stream
+      static GateRandom& local() {
+         static std::atomic<uint64_t> threads_count(0);
+         thread_local GateRandom instance(DefaultSeed + 0x9e3779b97f4a7c15ull * (++threads_count));
+         return instance;
+      }
+   };
+}
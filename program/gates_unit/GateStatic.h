@@ -0,0 +1,235 @@
+#pragma once
+
+#include "../shapes.h"
+#include "./GateObject.h"
+#include <array>
+#include <utility>
+
+namespace ins {
+
+   // Gate network of fixed dense topology: layer l has Widths[l] gates, each linked to every gate of layer l - 1
+   // Storage is inline, shapes are constants and each layer compute is instantiated apart, so loops
+   // unroll and nothing is allocated. Draws follow the GateObjectModel order, so that both models
+   // of a same topology and seed train identically.
+   template <size_t... Widths>
+   struct StaticGateNetwork {
+      typedef GateObject::weight_t weight_t;
+      typedef GateObject::weight_sum_t weight_sum_t;
+      typedef GateObject::mut_prob_t mut_prob_t;
+
+      static constexpr size_t LayersCount = sizeof...(Widths);
+      static constexpr size_t widths[LayersCount] = { Widths... };
+      static_assert(LayersCount >= 2, "a network has at least an input and an output layer");
+
+      static constexpr size_t get_words_count(size_t width) {
+         return (width + 63) / 64;
+      }
+      // Offset of layer l in gates and feedback signals, the input layer has no gate
+      static constexpr size_t get_gates_offset(size_t l) {
+         size_t offset = 0;
+         for (size_t m = 1; m < l; m++) offset += widths[m];
+         return offset;
+      }
+      // Offset of the links from layer l - 1 to layer l in weights
+      static constexpr size_t get_links_offset(size_t l) {
+         size_t offset = 0;
+         for (size_t m = 1; m < l; m++) offset += widths[m] * widths[m - 1];
+         return offset;
+      }
+      // Offset of layer l in states words
+      static constexpr size_t get_states_offset(size_t l) {
+         size_t offset = 0;
+         for (size_t m = 0; m < l; m++) offset += get_words_count(widths[m]);
+         return offset;
+      }
+
+      static constexpr size_t GatesCount = get_gates_offset(LayersCount);
+      static constexpr size_t LinksCount = get_links_offset(LayersCount);
+      static constexpr size_t StatesCount = get_states_offset(LayersCount);
+
+      std::array<GateObject, GatesCount> gates;
+      std::array<weight_t, LinksCount> weights;
+      std::array<mut_prob_t, LinksCount> mut_prob_neg;
+      std::array<mut_prob_t, LinksCount> mut_prob_pos;
+      std::array<uint64_t, StatesCount> states;
+      std::array<Scalar, GatesCount> feedback_signals;
+      GateRandom random;
+
+      explicit StaticGateNetwork(uint64_t seed = GateRandom::DefaultSeed)
+         : random(seed) {
+         mut_prob_neg.fill(0);
+         mut_prob_pos.fill(0);
+         states.fill(0);
+         feedback_signals.fill(0);
+
+         // Skip the draws of the input gates biases, unused but drawn by GateObjectModel
+         for (size_t i = 0; i < widths[0]; i++) random.uniform_signed();
+         this->initialize(std::make_index_sequence<LayersCount - 1>());
+      }
+
+      // Write the input layer, bit k of word w is input gate w * 64 + k
+      void write_inputs(const uint64_t* words) {
+         for (size_t w = 0; w < get_words_count(widths[0]); w++) {
+            states[w] = words[w] & Kernels::word_mask(w, widths[0]);
+         }
+      }
+      bool get_output(size_t index) const {
+         constexpr size_t offset = get_states_offset(LayersCount - 1);
+         return (states[offset + (index >> 6)] >> (index & 63)) & 1;
+      }
+      void emit_feedback(size_t index, Scalar feedback) {
+         feedback_signals[get_gates_offset(LayersCount - 1) + index] += feedback;
+      }
+      void compute_forward() {
+         this->compute_forward(std::make_index_sequence<LayersCount - 1>());
+      }
+      void compute_backward() {
+         this->compute_backward(std::make_index_sequence<LayersCount - 1>());
+      }
+
+   private:
+      static bool get_bit(const uint64_t* words, size_t index) {
+         return (words[index >> 6] >> (index & 63)) & 1;
+      }
+
+      template <size_t L>
+      void initialize_layer() {
+         constexpr size_t links_offset = get_links_offset(L);
+         constexpr size_t gates_offset = get_gates_offset(L);
+         for (size_t k = 0; k < widths[L] * widths[L - 1]; k++) {
+            weights[links_offset + k] = random.uniform_signed() * GateObject::WeightInit;
+         }
+         for (size_t i = 0; i < widths[L]; i++) {
+            gates[gates_offset + i].initialize(random);
+         }
+      }
+      template <size_t... L>
+      void initialize(std::index_sequence<L...>) {
+         (this->initialize_layer<L + 1>(), ...);
+      }
+
+      template <size_t L>
+      void compute_forward_layer() {
+         constexpr size_t width = widths[L - 1];
+         constexpr size_t height = widths[L];
+         const uint64_t* inputs = &states[get_states_offset(L - 1)];
+         uint64_t* outputs = &states[get_states_offset(L)];
+         const weight_t* layer_weights = &weights[get_links_offset(L)];
+         const GateObject* layer_gates = &gates[get_gates_offset(L)];
+
+         for (size_t w = 0; w < get_words_count(height); w++) outputs[w] = 0;
+         for (size_t i = 0; i < height; i++) {
+            weight_sum_t acc = layer_gates[i].gate.weight_base;
+            for (size_t k = 0; k < width; k++) {
+               acc += layer_weights[i * width + k] & -weight_t(get_bit(inputs, k));
+            }
+            outputs[i >> 6] |= uint64_t(acc > 0) << (i & 63);
+         }
+      }
+      template <size_t... L>
+      void compute_forward(std::index_sequence<L...>) {
+         (this->compute_forward_layer<L + 1>(), ...);
+      }
+
+      template <size_t L>
+      void compute_backward_layer() {
+         constexpr size_t width = widths[L - 1];
+         constexpr size_t height = widths[L];
+         constexpr size_t links_offset = get_links_offset(L);
+         constexpr size_t gates_offset = get_gates_offset(L);
+         const uint64_t* inputs = &states[get_states_offset(L - 1)];
+         const uint64_t* outputs = &states[get_states_offset(L)];
+
+         // Integrate feedback to stats, the input layer takes no feedback
+         GateMutation::Bounds bounds;
+         for (size_t i = 0; i < height; i++) {
+            auto& object = gates[gates_offset + i];
+            weight_t* row_weights = &weights[links_offset + i * width];
+            mut_prob_t* row_mut_prob_neg = &mut_prob_neg[links_offset + i * width];
+            mut_prob_t* row_mut_prob_pos = &mut_prob_pos[links_offset + i * width];
+
+            weight_sum_t links_weights_sum = object.gate.weight_base;
+            for (size_t k = 0; k < width; k++) {
+               links_weights_sum += abs(row_weights[k]) & -weight_t(get_bit(inputs, k));
+            }
+            auto feedback = object.integrate_feedback(feedback_signals[gates_offset + i], get_bit(outputs, i), links_weights_sum, width);
+            feedback_signals[gates_offset + i] = 0;
+            for (size_t k = 0; k < width; k++) {
+               Scalar lfeedback = feedback.integrate_link(object.gate, get_bit(inputs, k), row_weights[k], row_mut_prob_neg[k], row_mut_prob_pos[k]);
+               bounds.neg = std::max(bounds.neg, row_mut_prob_neg[k]);
+               bounds.pos = std::max(bounds.pos, row_mut_prob_pos[k]);
+               if constexpr (L > 1) {
+                  feedback_signals[get_gates_offset(L - 1) + k] += lfeedback;
+               }
+            }
+         }
+
+         // Mutate weights, and downscale overflowed gates
+         uint64_t overflows[get_words_count(height)] = {};
+         for (size_t i = 0; i < height; i++) {
+            auto& gate = gates[gates_offset + i].gate;
+            if (GateObject::mutate_weight(gate.weight_base, gate.mut_prob_neg, gate.mut_prob_pos, random)) {
+               overflows[i >> 6] |= uint64_t(1) << (i & 63);
+            }
+         }
+         GateMutation::mutate_array(&weights[links_offset], &mut_prob_neg[links_offset], &mut_prob_pos[links_offset], width * height,
+            bounds.neg, bounds.pos, GateObject::WeightMin, GateObject::WeightMax,
+            random, [&](size_t k) { overflows[(k / width) >> 6] |= uint64_t(1) << ((k / width) & 63); });
+         for (size_t i = 0; i < height; i++) {
+            if (!get_bit(overflows, i)) continue;
+            for (size_t k = 0; k < width; k++) {
+               weights[links_offset + i * width + k] = GateObject::downscale_weight(weights[links_offset + i * width + k]);
+            }
+            auto& gate = gates[gates_offset + i].gate;
+            gate.weight_base = GateObject::downscale_weight(gate.weight_base);
+         }
+      }
+      template <size_t... L>
+      void compute_backward(std::index_sequence<L...>) {
+         (this->compute_backward_layer<LayersCount - 1 - L>(), ...);
+      }
+   };
+
+   // Static network of a DenseShape, eg. StaticDenseGateNetwork<4, 16, 1> is StaticGateNetwork<16, 11, 6, 1>
+   template <uint32_t height, uint32_t input_width, uint32_t output_width, uint32_t internal_width = 0, uint32_t internal_height = 0>
+   struct StaticDenseShape {
+      static constexpr Shapes::DenseShape shape = Shapes::DenseShape(height, input_width, output_width, internal_width, internal_height);
+
+      template <size_t... I>
+      static StaticGateNetwork<shape.get_layer_width(I)...> make_network(std::index_sequence<I...>);
+
+      typedef decltype(make_network(std::make_index_sequence<height>())) network_t;
+   };
+   template <uint32_t height, uint32_t input_width, uint32_t output_width, uint32_t internal_width = 0, uint32_t internal_height = 0>
+   using StaticDenseGateNetwork = typename StaticDenseShape<height, input_width, output_width, internal_width, internal_height>::network_t;
+
+   namespace Models {
+
+      // Image model over a static network of 16 inputs, for pixel (i, j), and a single output gate
+      template <size_t... Widths>
+      struct StaticImage2DModel final : IImage2DTrainable {
+         StaticGateNetwork<16, Widths...> network;
+
+         StaticImage2DModel(uint64_t seed = GateRandom::DefaultSeed)
+            : network(seed) {
+         }
+         bool estimate_pixel(uint8_t i, uint8_t j) override {
+            uint64_t inputs = uint64_t(i) | (uint64_t(j) << 8);
+            network.write_inputs(&inputs);
+            network.compute_forward();
+            return network.get_output(0);
+         }
+         bool train_pixel(uint8_t i, uint8_t j, bool expected) override {
+            auto r = this->estimate_pixel(i, j);
+
+            Scalar feedback = (r == expected) ? 1.0f : -1.0f;
+            network.emit_feedback(0, feedback);
+            network.compute_backward();
+
+            return network.get_output(0);
+         }
+      };
+      typedef StaticImage2DModel<1> StaticSingleGateImage2DModel;
+      typedef StaticImage2DModel<4, 1> StaticHiddenLayerImage2DModel;
+   }
+}
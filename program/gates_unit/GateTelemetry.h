@@ -0,0 +1,171 @@
+#pragma once
+
+#include "../math.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+
+// Training telemetry, off unless built with INS_TELEMETRY=1 (CMake BITMESH_TELEMETRY)
+// When off, the INS_TELEMETRY_* macros expand to nothing and do not evaluate their arguments.
+#ifndef INS_TELEMETRY
+#define INS_TELEMETRY 0
+#endif
+
+namespace ins {
+
+   // Per layer counters and phase timers, summed over threads on snapshot
+   // Each thread counts into its own cache line aligned slot, with plain relaxed stores, so counting
+   // never contends. Threads past MaxThreads share the last slot, whose counts may then be lossy.
+   struct GateTelemetry {
+      enum Counter {
+         Forwards,          // full layer forwards
+         DeltaForwards,     // incremental layer forwards
+         DeltaFlips,        // input flips propagated by incremental forwards
+         Backwards,         // layer backwards
+         FeedbackMagnitude, // sum of gates |feedback signal|, in 1/1024 units
+         Mutations,         // link weights mutated
+         Downscales,        // gates downscaled on weight overflow
+         CountersCount,
+      };
+      enum Phase {
+         Forward,
+         DeltaForward,
+         Backward, // includes Mutation
+         Mutation,
+         PhasesCount,
+      };
+      static constexpr size_t MaxLayers = 16; // deeper layers count into the last one
+      static constexpr size_t MaxThreads = 64;
+      static constexpr Scalar FeedbackUnit = 1024;
+
+      static const char* get_counter_name(int counter) {
+         static const char* names[CountersCount] = { "forwards", "delta_forwards", "delta_flips", "backwards", "feedback_magnitude", "mutations", "downscales" };
+         return names[counter];
+      }
+      static const char* get_phase_name(int phase) {
+         static const char* names[PhasesCount] = { "forward_ns", "delta_forward_ns", "backward_ns", "mutation_ns" };
+         return names[phase];
+      }
+
+      struct alignas(64) Slot {
+         uint64_t counters[MaxLayers][CountersCount] = {};
+         uint64_t timers[MaxLayers][PhasesCount] = {}; // nanoseconds
+      };
+
+      struct Snapshot {
+         double seconds = 0; // since telemetry start or reset
+         size_t layers_count = 0; // layers with any count
+         uint64_t counters[MaxLayers][CountersCount] = {};
+         uint64_t timers[MaxLayers][PhasesCount] = {};
+      };
+
+      Slot slots[MaxThreads];
+      std::atomic<size_t> threads_count;
+      std::chrono::steady_clock::time_point start;
+
+      GateTelemetry()
+         : threads_count(0), start(std::chrono::steady_clock::now()) {
+      }
+      GateTelemetry(const GateTelemetry&) = delete;
+      GateTelemetry& operator=(const GateTelemetry&) = delete;
+
+      static GateTelemetry& instance() {
+         static GateTelemetry telemetry;
+         return telemetry;
+      }
+      // Slot of the calling thread
+      static Slot& get_slot() {
+         thread_local Slot* slot = 0;
+         if (!slot) {
+            auto& telemetry = instance();
+            size_t index = telemetry.threads_count.fetch_add(1, std::memory_order_relaxed);
+            slot = &telemetry.slots[std::min(index, MaxThreads - 1)];
+         }
+         return *slot;
+      }
+      static size_t get_layer_slot(size_t layer) {
+         return std::min(layer, MaxLayers - 1);
+      }
+      static void count(size_t layer, Counter counter, uint64_t value) {
+         auto& total = get_slot().counters[get_layer_slot(layer)][counter];
+         relaxed_store(total, relaxed_load(total) + value);
+      }
+
+      // Adds the scope duration to a phase timer
+      struct Timer {
+         uint64_t& total;
+         std::chrono::steady_clock::time_point start;
+
+         Timer(size_t layer, Phase phase)
+            : total(get_slot().timers[get_layer_slot(layer)][phase]), start(std::chrono::steady_clock::now()) {
+         }
+         ~Timer() {
+            auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+            relaxed_store(total, relaxed_load(total) + uint64_t(elapsed.count()));
+         }
+      };
+
+      // Sum of all slots, consistent per counter only, as threads keep counting
+      Snapshot snapshot() const {
+         Snapshot snapshot;
+         snapshot.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+         for (auto& slot : slots) {
+            for (size_t l = 0; l < MaxLayers; l++) {
+               for (int c = 0; c < CountersCount; c++) snapshot.counters[l][c] += relaxed_load(slot.counters[l][c]);
+               for (int p = 0; p < PhasesCount; p++) snapshot.timers[l][p] += relaxed_load(slot.timers[l][p]);
+            }
+         }
+         for (size_t l = 0; l < MaxLayers; l++) {
+            for (int c = 0; c < CountersCount; c++) if (snapshot.counters[l][c]) snapshot.layers_count = l + 1;
+            for (int p = 0; p < PhasesCount; p++) if (snapshot.timers[l][p]) snapshot.layers_count = l + 1;
+         }
+         return snapshot;
+      }
+      // Zero all counts, shall not run concurrently with counting threads
+      void reset() {
+         for (auto& slot : slots) slot = Slot();
+         start = std::chrono::steady_clock::now();
+      }
+
+      //--- Export, one CSV row or JSON object per layer and snapshot, so that periodic snapshots append
+
+      static void write_csv_header(FILE* file) {
+         fprintf(file, "seconds,layer");
+         for (int c = 0; c < CountersCount; c++) fprintf(file, ",%s", get_counter_name(c));
+         for (int p = 0; p < PhasesCount; p++) fprintf(file, ",%s", get_phase_name(p));
+         fprintf(file, "\n");
+      }
+      static void write_csv(FILE* file, const Snapshot& snapshot) {
+         for (size_t l = 0; l < snapshot.layers_count; l++) {
+            fprintf(file, "%.3f,%zu", snapshot.seconds, l);
+            for (int c = 0; c < CountersCount; c++) fprintf(file, ",%llu", (unsigned long long)snapshot.counters[l][c]);
+            for (int p = 0; p < PhasesCount; p++) fprintf(file, ",%llu", (unsigned long long)snapshot.timers[l][p]);
+            fprintf(file, "\n");
+         }
+      }
+      static void write_json(FILE* file, const Snapshot& snapshot) {
+         fprintf(file, "{\"seconds\": %.3f, \"layers\": [", snapshot.seconds);
+         for (size_t l = 0; l < snapshot.layers_count; l++) {
+            fprintf(file, "%s\n  {\"layer\": %zu", l ? "," : "", l);
+            for (int c = 0; c < CountersCount; c++) fprintf(file, ", \"%s\": %llu", get_counter_name(c), (unsigned long long)snapshot.counters[l][c]);
+            for (int p = 0; p < PhasesCount; p++) fprintf(file, ", \"%s\": %llu", get_phase_name(p), (unsigned long long)snapshot.timers[l][p]);
+            fprintf(file, "}");
+         }
+         fprintf(file, "\n]}\n");
+      }
+   };
+}
+
+#define INS_TELEMETRY_CONCAT_(a, b) a##b
+#define INS_TELEMETRY_CONCAT(a, b) INS_TELEMETRY_CONCAT_(a, b)
+
+#if INS_TELEMETRY
+#define INS_TELEMETRY_COUNT(layer, counter, value) ::ins::GateTelemetry::count(layer, ::ins::GateTelemetry::counter, value)
+#define INS_TELEMETRY_TIMER(layer, phase) ::ins::GateTelemetry::Timer INS_TELEMETRY_CONCAT(telemetry_timer_, __LINE__)(layer, ::ins::GateTelemetry::phase)
+#else
+#define INS_TELEMETRY_COUNT(layer, counter, value) ((void)0)
+#define INS_TELEMETRY_TIMER(layer, phase) ((void)0)
+#endif
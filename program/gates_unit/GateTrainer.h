@@ -0,0 +1,86 @@
+#pragma once
+
+#include "./GateObject.h"
+#include <chrono>
+#include <thread>
+
+namespace ins {
+
+   // Hogwild trainer: threads train one shared model at once, without any lock
+   // Each thread owns a context, so only the model parameters are shared. Their relaxed updates
+   // may lose a concurrent ±1 nudge or probability update, which the stochastic training tolerates.
+   // Model shall have a 'model' GateObjectModel, and a train_pixel(GateContext&, i, j, expected) to use train().
+   template <class Model>
+   struct GateHogwildTrainer {
+
+      struct Report {
+         size_t threads_count = 0;
+         size_t samples_count = 0;
+         double seconds = 0;
+
+         double samples_per_second() const {
+            return seconds > 0 ? double(samples_count) / seconds : 0;
+         }
+      };
+
+      Model& model;
+      std::vector<GateContext> contexts; // per thread evaluation state and mutations stream
+      std::vector<GateRandom> samplers; // per thread samples stream
+
+      GateHogwildTrainer(Model& model, size_t threads_count = std::thread::hardware_concurrency())
+         : model(model) {
+         if (threads_count == 0) threads_count = 1;
+         for (size_t t = 0; t < threads_count; t++) {
+            contexts.push_back(model.model.create_context(model.model.random.split()));
+            samplers.push_back(model.model.random.split());
+         }
+      }
+      size_t size() const {
+         return contexts.size();
+      }
+
+      // Run step(context, random, s) for each s < count, split over threads in contiguous ranges
+      template <class StepFn>
+      Report run(size_t count, StepFn step) {
+         size_t threads_count = this->size();
+         auto thread_main = [&](size_t t) {
+            auto& context = contexts[t];
+            auto& random = samplers[t];
+            size_t begin = count * t / threads_count;
+            size_t end = count * (t + 1) / threads_count;
+            for (size_t s = begin; s < end; s++) {
+               step(context, random, s);
+            }
+         };
+
+         auto start = std::chrono::steady_clock::now();
+         std::vector<std::thread> threads;
+         for (size_t t = 1; t < threads_count; t++) {
+            threads.emplace_back(thread_main, t);
+         }
+         thread_main(0);
+         for (auto& thread : threads) thread.join();
+         std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+         // Weights may have changed under the default context, so its accumulators shall be resynced
+         model.model.context.accumulated = false;
+
+         Report report;
+         report.threads_count = threads_count;
+         report.samples_count = count;
+         report.seconds = elapsed.count();
+         return report;
+      }
+
+      // Train 'samples_count' samples split over threads, sample(random, i, j, expected) draws one sample
+      template <class SampleFn>
+      Report train(size_t samples_count, SampleFn sample) {
+         return this->run(samples_count, [&](GateContext& context, GateRandom& random, size_t) {
+            uint8_t i, j;
+            bool expected;
+            sample(random, i, j, expected);
+            model.train_pixel(context, i, j, expected);
+            });
+      }
+   };
+}
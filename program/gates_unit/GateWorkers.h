@@ -0,0 +1,116 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ins {
+
+   // Persistent worker threads running batches of indexed tasks
+   // The calling thread takes part in the batch, so a pool of size 1 has no thread.
+   struct GateWorkerPool {
+      typedef void(*task_t)(void* context, size_t index);
+
+      std::vector<std::thread> threads;
+      std::mutex mutex;
+      std::condition_variable wakeup;
+      std::condition_variable finished;
+      uint64_t generation = 0;
+      bool stopping = false;
+
+      task_t task = 0;
+      void* context = 0;
+      size_t tasks_count = 0;
+      std::atomic<size_t> next_task;
+      size_t running = 0;
+
+      explicit GateWorkerPool(size_t workers_count = std::thread::hardware_concurrency())
+         : next_task(0) {
+         for (size_t i = 1; i < workers_count; i++) {
+            threads.emplace_back([this]() { this->worker_main(); });
+         }
+      }
+      ~GateWorkerPool() {
+         {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+         }
+         wakeup.notify_all();
+         for (auto& thread : threads) thread.join();
+      }
+      GateWorkerPool(const GateWorkerPool&) = delete;
+      GateWorkerPool& operator=(const GateWorkerPool&) = delete;
+
+      size_t size() const {
+         return threads.size() + 1;
+      }
+
+      // Run fn(index) for index in [0, count), and return when all are done
+      template <class Fn>
+      void run(size_t count, Fn& fn) {
+         if (count == 0) return;
+         if (count == 1 || threads.empty()) {
+            for (size_t i = 0; i < count; i++) fn(i);
+            return;
+         }
+         {
+            std::lock_guard<std::mutex> lock(mutex);
+            task = [](void* context, size_t index) { (*(Fn*)context)(index); };
+            context = &fn;
+            tasks_count = count;
+            next_task.store(0, std::memory_order_relaxed);
+            running = threads.size();
+            generation++;
+         }
+         wakeup.notify_all();
+         execute();
+         std::unique_lock<std::mutex> lock(mutex);
+         finished.wait(lock, [this]() { return running == 0; });
+      }
+
+      // Split [0, count) in at most size() ranges aligned on 'align', and run fn(begin, end, range_index)
+      // The partition depends only on count and size(), so results merged per range are deterministic.
+      template <class Fn>
+      void run_ranges(size_t count, size_t align, Fn& fn) {
+         size_t blocks = (count + align - 1) / align;
+         size_t ranges = blocks < size() ? blocks : size();
+         auto range_fn = [&](size_t r) {
+            size_t begin = (blocks * r / ranges) * align;
+            size_t end = (blocks * (r + 1) / ranges) * align;
+            fn(begin, end < count ? end : count, r);
+         };
+         run(ranges, range_fn);
+      }
+      size_t get_ranges_count(size_t count, size_t align) const {
+         size_t blocks = (count + align - 1) / align;
+         return blocks < size() ? blocks : size();
+      }
+
+   private:
+      void execute() {
+         for (size_t i; (i = next_task.fetch_add(1, std::memory_order_relaxed)) < tasks_count;) {
+            task(context, i);
+         }
+      }
+      void worker_main() {
+         uint64_t seen = 0;
+         for (;;) {
+            {
+               std::unique_lock<std::mutex> lock(mutex);
+               wakeup.wait(lock, [&]() { return stopping || generation != seen; });
+               if (stopping) return;
+               seen = generation;
+            }
+            execute();
+            {
+               std::lock_guard<std::mutex> lock(mutex);
+               if (--running == 0) finished.notify_one();
+            }
+         }
+      }
+   };
+}
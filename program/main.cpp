@@ -1,4 +1,10 @@
 #include "./gates_unit/GateObject.h"
+#include "./gates_unit/GatePopulation.h"
+#include "./gates_unit/GateStatic.h"
+#include "./gates_unit/GateTrainer.h"
+#include "./MNIST.h"
+#include "./progress.h"
+#include "./shapes.h"
 #include <functional>
 #include <stdio.h>
 #include <windows.h>
@@ -39,11 +45,11 @@ extern void print_line(int line, const char* pattern, ...) {
    }
 }
 
-void ins::IImage2DModel::print_image(int at_line) {
+void print_image_bits(const Image2DBits& image, int at_line) {
    char row[65];
    for (int i = 0; i < 32; i++) {
       for (int j = 0; j < 32; j++) {
-         auto c = estimate_pixel(i, j) ? '\xb2' : '\xb0';
+         auto c = image.get(i, j) ? '\xb2' : '\xb0';
          row[j * 2 + 0] = c;
          row[j * 2 + 1] = c;
       }
@@ -52,40 +58,20 @@ void ins::IImage2DModel::print_image(int at_line) {
    }
 }
 
-namespace ins {
-   namespace Shapes {
-
-      struct DenseShape {
-         uint32_t height;
-         uint32_t input_width;
-         uint32_t output_width;
-         uint32_t internal_width;
-         uint32_t internal_height;
-         DenseShape(uint32_t height, uint32_t input_width, uint32_t output_width, uint32_t internal_width = 0, uint32_t internal_height = 0)
-            :height(height), input_width(input_width), output_width(output_width), internal_width(internal_width), internal_height(internal_height)
-         {
-            if (this->internal_width == 0) {
-               this->internal_height = 0;
-               this->internal_width = this->input_width;
-            }
-            else if (this->internal_height == 0) {
-               this->internal_height = this->height / 2;
-            }
-         }
-         uint32_t get_layer_width(int i) {
-            if (i < internal_height) {
-               float ratio = float(i) / float(internal_height);
-               return input_width + uint32_t(ratio * int32_t(internal_width - input_width));
-            }
-            else {
-               float ratio = float(i - internal_height) / float(height - 1 - internal_height);
-               return internal_width + uint32_t(ratio * int32_t(output_width - internal_width));
-            }
-         }
-      };
-   }
+void ins::IImage2DModel::print_image(int at_line) {
+   Image2DBits image;
+   estimate_image(image);
+   print_image_bits(image, at_line);
 }
 
+// Render progress frames to the console window
+struct ConsoleImage2DRenderer : IImage2DRenderer {
+   void render(const Image2DSnapshot& snapshot) override {
+      print_line(3, "> iteration: %d", int(snapshot.iteration));
+      print_image_bits(snapshot.image, 4);
+   }
+};
+
 struct halfspace1_image : IImage2DModel {
    bool estimate_pixel(uint8_t i, uint8_t j) override {
       return (2 * int(i) - 1 * int(j)) < 8;
@@ -130,8 +116,61 @@ struct circles_image : IImage2DModel {
    }
 };
 
+// Report Hogwild training throughput of a model from 1 thread to all hardware threads
+template <class Model>
+int run_hogwild_scaling(IImage2DModel& image_ref, size_t samples_count) {
+   size_t max_threads = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+   for (size_t threads_count = 1;; threads_count = std::min(threads_count * 2, max_threads)) {
+      Model model;
+      GateHogwildTrainer<Model> trainer(model, threads_count);
+      auto report = trainer.train(samples_count, [&](GateRandom& random, uint8_t& i, uint8_t& j, bool& expected) {
+         i = random.next_u32() % 32;
+         j = random.next_u32() % 32;
+         expected = image_ref.estimate_pixel(i, j);
+         });
+
+      size_t matches = 0;
+      for (int i = 0; i < 32; i++) {
+         for (int j = 0; j < 32; j++) {
+            matches += model.estimate_pixel(i, j) == image_ref.estimate_pixel(i, j);
+         }
+      }
+      printf("> threads: %zu, samples/sec: %.0f, accuracy: %zu/1024\n", report.threads_count, report.samples_per_second(), matches);
+      if (threads_count == max_threads) break;
+   }
+   return 0;
+}
+
+// Train a population of models over all reference images, seeds and feedback scales, and print the leaderboard
+int run_population(size_t models_count, size_t samples_count) {
+   halfspace1_image halfspace1;
+   halfspace2_image halfspace2;
+   halfspace3_image halfspace3;
+   halfspace4_image halfspace4;
+   band_image band;
+   circles_image circles;
+   struct Target { const char* name; IImage2DModel* image; };
+   Target targets[] = { { "halfspace1", &halfspace1 }, { "halfspace2", &halfspace2 }, { "halfspace3", &halfspace3 },
+      { "halfspace4", &halfspace4 }, { "band", &band }, { "circles", &circles } };
+   Scalar feedbacks[] = { 1.0f, 0.5f, 0.25f };
+
+   GateWorkerPool workers;
+   Models::HiddenLayerImage2DPopulation population;
+   population.workers = &workers;
+   for (size_t k = 0; k < models_count; k++) {
+      auto& target = targets[k % 6];
+      population.add(target.name, *target.image, GateRandom::DefaultSeed + k, feedbacks[(k / 6) % 3]);
+   }
+
+   auto start = std::chrono::steady_clock::now();
+   population.train(samples_count);
+   double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+   printf("> models: %zu, samples/sec per model: %.0f\n", population.size(), double(samples_count) / seconds);
+   population.write_leaderboard(stdout, 20);
+   return 0;
+}
 
-int main() {
+int main(int argc, char** argv) {
 
    //halfspace4_image image_ref;
     halfspace2_image image_ref;
@@ -140,11 +179,35 @@ int main() {
 
    Models::SingleGateImage2DModel model;
    //Models::HiddenLayerImage2DModel model;
+   //Models::StaticHiddenLayerImage2DModel model;
 
-   print_clean();
-   print_line(3, "> dataset:");
-   image_ref.print_image();
-   Sleep(500);
+   if (argc > 1 && !strcmp(argv[1], "--hogwild")) {
+      return run_hogwild_scaling<Models::SingleGateImage2DModel>(image_ref, 1000000);
+   }
+   // Population sweep with '--population <count>'
+   if (argc > 2 && !strcmp(argv[1], "--population")) {
+      return run_population(atoi(argv[2]), 100000);
+   }
+   // MNIST training with '--mnist <dir> [<checkpoint>]'
+   if (argc > 2 && !strcmp(argv[1], "--mnist")) {
+      return MNIST::run(argv[2], 10, std::thread::hardware_concurrency(), argc > 3 ? argv[3] : 0);
+   }
+
+   // Progress is rendered to the console, or to a text file with '--output <path>'
+   FILE* output = 0;
+   if (argc > 2 && !strcmp(argv[1], "--output")) {
+      output = fopen(argv[2], "w");
+      if (!output) return 1;
+   }
+   else {
+      print_clean();
+      print_line(3, "> dataset:");
+      image_ref.print_image();
+      Sleep(500);
+   }
+   ConsoleImage2DRenderer console_renderer;
+   Image2DFileRenderer file_renderer(output);
+   Image2DProgress progress(output ? (IImage2DRenderer&)file_renderer : console_renderer);
 
    size_t epoch_count = 10000;
    size_t cycle_count = 100;
@@ -155,9 +218,9 @@ int main() {
          auto expected = image_ref.estimate_pixel(i, j);
          model.train_pixel(i, j, expected);
       }
-      print_line(3, "> iteration: %d", e * cycle_count);
-      model.print_image();
+      progress.publish(model, (e + 1) * cycle_count);
    }
+   progress.finish(model, epoch_count * cycle_count);
 
    return 0;
 }
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace ins {
+
+   // Read-only memory mapping of a whole file
+   // Pages are loaded lazily by the OS on first access, so opening does not read the file.
+   struct MappedFile {
+      const uint8_t* data = 0;
+      size_t size = 0;
+
+      MappedFile() {
+      }
+      explicit MappedFile(const char* path) {
+         this->open(path);
+      }
+      ~MappedFile() {
+         this->close();
+      }
+      MappedFile(const MappedFile&) = delete;
+      MappedFile& operator=(const MappedFile&) = delete;
+      MappedFile(MappedFile&& other) noexcept {
+         this->swap(other);
+      }
+      MappedFile& operator=(MappedFile&& other) noexcept {
+         this->swap(other);
+         return *this;
+      }
+
+      bool is_open() const {
+         return this->data != 0;
+      }
+
+      // Map 'path', returns false when it cannot be opened or is empty
+      bool open(const char* path) {
+         this->close();
+#if defined(_WIN32)
+         HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, 0);
+         if (file == INVALID_HANDLE_VALUE) return false;
+         LARGE_INTEGER file_size;
+         if (GetFileSizeEx(file, &file_size) && file_size.QuadPart > 0) {
+            HANDLE mapping = CreateFileMappingA(file, 0, PAGE_READONLY, 0, 0, 0);
+            if (mapping) {
+               this->data = (const uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+               if (this->data) this->size = size_t(file_size.QuadPart);
+               CloseHandle(mapping);
+            }
+         }
+         CloseHandle(file);
+#else
+         int fd = ::open(path, O_RDONLY);
+         if (fd < 0) return false;
+         struct stat st;
+         if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            void* p = mmap(0, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED) {
+               madvise(p, size_t(st.st_size), MADV_WILLNEED);
+               this->data = (const uint8_t*)p;
+               this->size = size_t(st.st_size);
+            }
+         }
+         ::close(fd);
+#endif
+         return this->is_open();
+      }
+      void close() {
+         if (!this->data) return;
+#if defined(_WIN32)
+         UnmapViewOfFile(this->data);
+#else
+         munmap((void*)this->data, this->size);
+#endif
+         this->data = 0;
+         this->size = 0;
+      }
+      void swap(MappedFile& other) {
+         const uint8_t* data = this->data;
+         size_t size = this->size;
+         this->data = other.data;
+         this->size = other.size;
+         other.data = data;
+         other.size = size;
+      }
+   };
+}
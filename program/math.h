@@ -2,7 +2,9 @@
 
 #include <vector>
 #include <algorithm>
+#include <initializer_list>
 #include <random>
+#include <type_traits>
 
 namespace ins {
    
@@ -13,8 +15,88 @@ namespace ins {
       return x < _min ? _min : (x > _max ? _max : x);
    }
 
+   // Relaxed atomic access to plain values shared between threads without locks
+   template <class T>
+   inline T relaxed_load(const T& value) {
+#if defined(__GNUC__) || defined(__clang__)
+      return __atomic_load_n(&value, __ATOMIC_RELAXED);
+#else
+      return *(const volatile T*)&value;
+#endif
+   }
+   template <class T>
+   inline void relaxed_store(T& value, T new_value) {
+#if defined(__GNUC__) || defined(__clang__)
+      __atomic_store_n(&value, new_value, __ATOMIC_RELAXED);
+#else
+      *(volatile T*)&value = new_value;
+#endif
+   }
+
+   // Non-owning view of 'size' contiguous values, eg. of a vector, an array or a braced list
+   // A braced list lives until the end of the full expression, so it can be passed to a call taking a span.
+   template <class T>
+   struct Span {
+      typedef typename std::remove_const<T>::type value_type;
+
+      T* data = 0;
+      size_t size = 0;
+
+      Span() {
+      }
+      Span(T* data, size_t size)
+         : data(data), size(size) {
+      }
+      template <class Container, class = decltype(std::declval<Container&>().data())>
+      Span(Container& container)
+         : data(container.data()), size(container.size()) {
+      }
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Winit-list-lifetime"
+#endif
+      Span(std::initializer_list<value_type> list)
+         : data(list.begin()), size(list.size()) {
+      }
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+      T* begin() const { return data; }
+      T* end() const { return data + size; }
+      T& operator[](size_t index) const { return data[index]; }
+   };
+
+   // 32x32 binary image, pixel (i, j) is at bit (i % 2) * 32 + j of word i / 2
+   struct Image2DBits {
+      uint64_t words[16] = {};
+
+      bool get(int i, int j) const {
+         return (words[i >> 1] >> ((i & 1) * 32 + j)) & 1;
+      }
+   };
+
    struct IImage2DModel {
       virtual bool estimate_pixel(uint8_t i, uint8_t j) = 0;
+      // Estimate up to 64 pixels (i, j) at once, the result of pixel k is at bit k
+      virtual uint64_t estimate_pixels(const uint8_t(*pixels)[2], int count) {
+         uint64_t result = 0;
+         for (int k = 0; k < count; k++) {
+            result |= uint64_t(estimate_pixel(pixels[k][0], pixels[k][1])) << k;
+         }
+         return result;
+      }
+      // Estimate the whole 32x32 image, two rows per batch of 64 pixels
+      void estimate_image(Image2DBits& image) {
+         uint8_t pixels[64][2];
+         for (int w = 0; w < 16; w++) {
+            for (int k = 0; k < 64; k++) {
+               pixels[k][0] = w * 2 + k / 32;
+               pixels[k][1] = k % 32;
+            }
+            image.words[w] = estimate_pixels(pixels, 64);
+         }
+      }
       void print_image(int at_line = 4);
 
    };
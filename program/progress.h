@@ -0,0 +1,128 @@
+#pragma once
+
+#include "./math.h"
+#include "./thread_priority.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <stdio.h>
+#include <thread>
+
+namespace ins {
+
+   struct Image2DSnapshot {
+      uint64_t iteration = 0;
+      Image2DBits image;
+   };
+
+   // Backend drawing progress frames, called from the render thread only
+   struct IImage2DRenderer {
+      virtual void render(const Image2DSnapshot& snapshot) = 0;
+   };
+
+   // Text frames to a file, or redrawn in place on an ANSI terminal
+   struct Image2DFileRenderer : IImage2DRenderer {
+      FILE* file;
+      bool redraw;
+
+      Image2DFileRenderer(FILE* file, bool redraw = false)
+         : file(file), redraw(redraw) {
+      }
+      void render(const Image2DSnapshot& snapshot) override {
+         char row[66];
+         if (redraw) fputs("\x1b[H", file);
+         fprintf(file, "> iteration: %llu\n", (unsigned long long)snapshot.iteration);
+         for (int i = 0; i < 32; i++) {
+            for (int j = 0; j < 32; j++) {
+               auto c = snapshot.image.get(i, j) ? '#' : '.';
+               row[j * 2 + 0] = c;
+               row[j * 2 + 1] = c;
+            }
+            row[64] = '\n';
+            row[65] = 0;
+            fputs(row, file);
+         }
+         fflush(file);
+      }
+   };
+
+   // Training progress rendered by a low priority thread at a fixed frame rate
+   // The trainer calls publish() as often as it likes: the model is only snapshot when a frame
+   // is due, and never when the render thread holds the snapshot, so training never blocks on output.
+   struct Image2DProgress {
+      IImage2DRenderer& renderer;
+      std::chrono::microseconds frame_period;
+
+      std::mutex mutex; // guards snapshot and flags below
+      std::condition_variable wakeup;
+      Image2DSnapshot snapshot;
+      bool has_snapshot = false;
+      bool stopping = false;
+      std::atomic<bool> frame_due;
+
+      std::thread thread;
+
+      Image2DProgress(IImage2DRenderer& renderer, double frames_per_second = 30)
+         : renderer(renderer), frame_period(int64_t(1e6 / frames_per_second)), frame_due(true) {
+         thread = std::thread([this]() { this->render_main(); });
+      }
+      ~Image2DProgress() {
+         {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+         }
+         wakeup.notify_all();
+         thread.join();
+      }
+      Image2DProgress(const Image2DProgress&) = delete;
+      Image2DProgress& operator=(const Image2DProgress&) = delete;
+
+      // Snapshot the model when a frame is due, and return true when done
+      bool publish(IImage2DModel& model, uint64_t iteration) {
+         if (!frame_due.load(std::memory_order_relaxed)) return false;
+
+         std::unique_lock<std::mutex> lock(mutex, std::try_to_lock);
+         if (!lock.owns_lock()) return false;
+         model.estimate_image(snapshot.image);
+         snapshot.iteration = iteration;
+         has_snapshot = true;
+         frame_due.store(false, std::memory_order_relaxed);
+         lock.unlock();
+         wakeup.notify_one();
+         return true;
+      }
+
+      // Snapshot the model regardless of the frame rate, waiting for the render thread if needed
+      void finish(IImage2DModel& model, uint64_t iteration) {
+         {
+            std::lock_guard<std::mutex> lock(mutex);
+            model.estimate_image(snapshot.image);
+            snapshot.iteration = iteration;
+            has_snapshot = true;
+            frame_due.store(false, std::memory_order_relaxed);
+         }
+         wakeup.notify_one();
+      }
+
+   private:
+      void render_main() {
+         lower_thread_priority();
+         auto next_frame = std::chrono::steady_clock::now();
+         for (;;) {
+            Image2DSnapshot frame;
+            {
+               std::unique_lock<std::mutex> lock(mutex);
+               wakeup.wait_until(lock, next_frame, [this]() { return stopping; });
+               frame_due.store(true, std::memory_order_relaxed);
+               wakeup.wait(lock, [this]() { return stopping || has_snapshot; });
+               if (!has_snapshot) return;
+               frame = snapshot;
+               has_snapshot = false;
+            }
+            renderer.render(frame);
+            next_frame = std::max(next_frame + frame_period, std::chrono::steady_clock::now());
+         }
+      }
+   };
+}
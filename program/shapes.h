@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdint.h>
+
+namespace ins {
+   namespace Shapes {
+
+      // Dense layers stack, whose widths go linearly from input to internal width,
+      // then from internal to output width
+      struct DenseShape {
+         uint32_t height;
+         uint32_t input_width;
+         uint32_t output_width;
+         uint32_t internal_width;
+         uint32_t internal_height;
+         constexpr DenseShape(uint32_t height, uint32_t input_width, uint32_t output_width, uint32_t internal_width = 0, uint32_t internal_height = 0)
+            :height(height), input_width(input_width), output_width(output_width), internal_width(internal_width), internal_height(internal_height)
+         {
+            if (this->internal_width == 0) {
+               this->internal_height = 0;
+               this->internal_width = this->input_width;
+            }
+            else if (this->internal_height == 0) {
+               this->internal_height = this->height / 2;
+            }
+         }
+         constexpr uint32_t get_layer_width(uint32_t i) const {
+            if (i < internal_height) {
+               float ratio = float(i) / float(internal_height);
+               return uint32_t(int32_t(input_width) + int32_t(ratio * (int32_t(internal_width) - int32_t(input_width))));
+            }
+            else {
+               float ratio = float(i - internal_height) / float(height - 1 - internal_height);
+               return uint32_t(int32_t(internal_width) + int32_t(ratio * (int32_t(output_width) - int32_t(internal_width))));
+            }
+         }
+      };
+   }
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace ins {
+
+   // Run the calling thread only when the CPU would otherwise be idle, eg. for rendering or saving
+   // in the background of training threads. Other platforms keep the default priority.
+   inline void lower_thread_priority() {
+#if defined(_WIN32)
+      SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_IDLE);
+#elif defined(__linux__)
+      sched_param param = {};
+      pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+#endif
+   }
+}